@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * acmatch.c: Aho-Corasick multi-pattern matcher, see acmatch.h.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acmatch.h"
+
+
+/* A signature read from the file. */
+struct acm_sig {
+    int tag;
+    char *pattern;
+};
+
+
+void acm_free (struct acm *a) {
+    if (a == NULL) return;
+
+    free(a->tags);
+    free(a->next);
+    free(a->out);
+    free(a->dict);
+    free(a->sig_tag);
+    free(a->sig_next);
+    free(a);
+}
+
+/* Find or add a tag, returns its id or -1 if there are too many. */
+static int _acm_tag (struct acm *a, const char *tag) {
+    int i;
+
+    for (i = 0; i < a->ntags; i++) {
+        if (strcmp(a->tags[i], tag) == 0) return i;
+    }
+
+    if (a->ntags == ACM_MAX_TAGS) return -1;
+
+    snprintf(a->tags[a->ntags], ACM_TAG_LEN, "%s", tag);
+
+    return a->ntags++;
+}
+
+/* Read the signature file, assign tags and byte classes. */
+static int _acm_read (struct acm *a, const char *path, struct acm_sig **sigs,
+        int *nsigs, size_t *nbytes, char *err, size_t errlen) {
+    char *line = NULL;
+    size_t len = 0;
+    int n = 0, max = 0, lineno = 0;
+    FILE *fd;
+
+    fd = fopen(path, "r");
+
+    if (fd == NULL) {
+        snprintf(err, errlen, "Unable to open %s: %m", path);
+        return -1;
+    }
+
+    *nbytes = 0;
+
+    while (getline(&line, &len, fd) != -1) {
+        char *tag = line, *pat, *end;
+
+        lineno++;
+
+        while (isspace((unsigned char) *tag)) tag++;
+        if (*tag == '\0' || *tag == '#') continue;
+
+        /* Split the tag from the pattern, trim the pattern. */
+        for (pat = tag; *pat && !isspace((unsigned char) *pat); pat++);
+        if (*pat) *pat++ = '\0';
+        while (isspace((unsigned char) *pat)) pat++;
+        for (end = pat + strlen(pat); end > pat &&
+            isspace((unsigned char) end[-1]); end--);
+        *end = '\0';
+
+        if (*pat == '\0' || strlen(tag) > ACM_TAG_LEN - 1) {
+            snprintf(err, errlen, "%s:%d: invalid signature", path, lineno);
+            goto fail;
+        }
+
+        if (n == max) {
+            struct acm_sig *tmp;
+
+            max = max ? max * 2 : 256;
+            tmp = realloc(*sigs, max * sizeof(struct acm_sig));
+
+            if (tmp == NULL) {
+                snprintf(err, errlen, "Unable to allocate memory");
+                goto fail;
+            }
+
+            *sigs = tmp;
+        }
+
+        (*sigs)[n].tag = _acm_tag(a, tag);
+        (*sigs)[n].pattern = strdup(pat);
+
+        if ((*sigs)[n].tag < 0 || (*sigs)[n].pattern == NULL) {
+            snprintf(err, errlen, "%s:%d: too many tags or out of memory",
+                path, lineno);
+            free((*sigs)[n].pattern);
+            goto fail;
+        }
+
+        /* Matching is case insensitive, classes are built on lower case. */
+        for (end = (*sigs)[n].pattern; *end; end++) {
+            unsigned char c = tolower((unsigned char) *end);
+
+            *end = c;
+            if (a->cls[c] == 0) a->cls[c] = ++a->nclasses;
+            (*nbytes)++;
+        }
+
+        n++;
+        *nsigs = n;
+    }
+
+    free(line);
+    fclose(fd);
+
+    if (n == 0) {
+        snprintf(err, errlen, "%s: no signatures", path);
+        return -1;
+    }
+
+    return 0;
+
+fail:
+    free(line);
+    fclose(fd);
+
+    return -1;
+}
+
+struct acm *acm_load (const char *path, char *err, size_t errlen) {
+    struct acm_sig *sigs = NULL;
+    struct acm *a;
+    uint32_t *fail = NULL, *queue = NULL;
+    uint32_t head = 0, tail = 0, s, u, v;
+    size_t nbytes = 0, k;
+    int nsigs = 0, i, c;
+
+    a = calloc(1, sizeof(struct acm));
+
+    if (a == NULL || (a->tags = calloc(ACM_MAX_TAGS, ACM_TAG_LEN)) == NULL) {
+        snprintf(err, errlen, "Unable to allocate memory");
+        free(a);
+        return NULL;
+    }
+
+    if (_acm_read(a, path, &sigs, &nsigs, &nbytes, err, errlen)) {
+        goto fail;
+    }
+
+    /* Class 0 stands for bytes not used by any pattern. */
+    k = ++a->nclasses;
+
+    for (c = 0; c < 256; c++) {
+        a->cls[c] = a->cls[tolower(c)];
+    }
+
+    /* The trie has at most one state per pattern byte plus the root. */
+    a->next = calloc((nbytes + 1) * k, sizeof(uint32_t));
+    a->out = malloc((nbytes + 1) * sizeof(int32_t));
+    a->dict = calloc(nbytes + 1, sizeof(uint32_t));
+    a->sig_tag = malloc(nsigs * sizeof(int32_t));
+    a->sig_next = malloc(nsigs * sizeof(int32_t));
+    fail = calloc(nbytes + 1, sizeof(uint32_t));
+    queue = malloc((nbytes + 1) * sizeof(uint32_t));
+
+    if (!a->next || !a->out || !a->dict || !a->sig_tag || !a->sig_next ||
+        !fail || !queue) {
+        snprintf(err, errlen, "Unable to allocate memory");
+        goto fail;
+    }
+
+    a->out[0] = -1;
+    a->nstates = 1;
+
+    /* Build the trie, 0 means no edge as nothing leads back to the root. */
+    for (i = 0; i < nsigs; i++) {
+        const unsigned char *p = (const unsigned char *) sigs[i].pattern;
+
+        for (s = 0; *p; p++) {
+            uint32_t *e = &a->next[s * k + a->cls[*p]];
+
+            if (*e == 0) {
+                *e = a->nstates;
+                a->out[a->nstates++] = -1;
+            }
+
+            s = *e;
+        }
+
+        /* Identical patterns may carry different tags, chain them. */
+        a->sig_tag[i] = sigs[i].tag;
+        a->sig_next[i] = a->out[s];
+        a->out[s] = i;
+    }
+
+    /* Breadth first: compute fail links and turn the trie into a DFA.  When a
+     * state is dequeued only its trie edges are set in its row, and the row of
+     * its fail state, which is shallower, is already complete. */
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        u = queue[head++];
+
+        for (c = 0; c < k; c++) {
+            v = a->next[u * k + c];
+
+            if (v) {
+                fail[v] = u ? a->next[fail[u] * k + c] : 0;
+                a->dict[v] = a->out[fail[v]] >= 0 ? fail[v] :
+                    a->dict[fail[v]];
+                queue[tail++] = v;
+            } else if (u) {
+                a->next[u * k + c] = a->next[fail[u] * k + c];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+
+    for (i = 0; i < nsigs; i++) {
+        free(sigs[i].pattern);
+    }
+    free(sigs);
+
+    return a;
+
+fail:
+    free(fail);
+    free(queue);
+
+    for (i = 0; i < nsigs; i++) {
+        free(sigs[i].pattern);
+    }
+    free(sigs);
+    acm_free(a);
+
+    return NULL;
+}
+
+int acm_scan (const struct acm *a, const char *text, size_t len,
+        uint8_t *seen) {
+    const unsigned char *p = (const unsigned char *) text;
+    const unsigned char *end = p + len;
+    uint32_t k = a->nclasses;
+    uint32_t s = 0, t;
+    int n = 0;
+
+    for (; p < end; p++) {
+        s = a->next[s * k + a->cls[*p]];
+
+        /* Report every pattern ending here, along the output links. */
+        for (t = a->out[s] >= 0 ? s : a->dict[s]; t; t = a->dict[t]) {
+            int32_t i;
+
+            for (i = a->out[t]; i >= 0; i = a->sig_next[i]) {
+                int tag = a->sig_tag[i];
+
+                if (!(seen[tag >> 3] & (1 << (tag & 7)))) {
+                    seen[tag >> 3] |= 1 << (tag & 7);
+                    n++;
+                }
+            }
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * acmatch.h: Aho-Corasick multi-pattern matcher for tagging job scripts.
+ *
+ * A signature file has one signature per line, a tag followed by white space
+ * and the pattern (the rest of the line).  Several patterns may share a tag,
+ * matching is case insensitive and lines starting with '#' are comments:
+ *
+ *   VASP      vasp_std
+ *   GROMACS   gmx mdrun
+ *   PyTorch   import torch
+ *
+ * The patterns are compiled into a DFA over the byte classes that occur in
+ * them, so a scan is a single pass with one table lookup per byte, whatever
+ * the number of signatures.  The automaton is read-only once built and can be
+ * shared by concurrent scans.
+ *
+ */
+
+#ifndef _ACMATCH_H
+#define _ACMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACM_MAX_TAGS 4096
+#define ACM_TAG_LEN 64
+
+struct acm {
+    int ntags;
+    char (*tags)[ACM_TAG_LEN];
+    int nclasses;
+    uint8_t cls[256];       /* Byte to class, 0 = not in any pattern. */
+    uint32_t nstates;
+    uint32_t *next;         /* nstates x nclasses transitions. */
+    int32_t *out;           /* First signature ending in a state, or -1. */
+    uint32_t *dict;         /* Next state with an output on the fail chain. */
+    int32_t *sig_tag;       /* Tag of a signature. */
+    int32_t *sig_next;      /* Next signature ending in the same state. */
+};
+
+/* Compile a signature file, NULL on error with a message in err. */
+struct acm *acm_load(const char *path, char *err, size_t errlen);
+
+/* Free an automaton. */
+void acm_free(struct acm *a);
+
+/* Scan a text, set the bit of every tag found in seen (ACM_MAX_TAGS bits,
+ * cleared by the caller) and return the number of distinct tags found. */
+int acm_scan(const struct acm *a, const char *text, size_t len,
+    uint8_t *seen);
+
+#endif /* _ACMATCH_H */
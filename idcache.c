@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * idcache.c: Node local uid to (gid, user name) cache, see idcache.h.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "idcache.h"
+
+
+/* Initialization state: 0 = not tried, 1 = in progress, 2 = ready,
+ * -1 = disabled. */
+static int idcache_state = 0;
+static struct idcache_shm *idcache_shm = NULL;
+
+
+/* Map the state file and initialize it if it is new. */
+static int _idcache_map (void) {
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(IDCACHE_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) || ((size_t) st.st_size != sizeof(struct idcache_shm)
+        && ftruncate(fd, sizeof(struct idcache_shm)))) {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(struct idcache_shm), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    idcache_shm = p;
+
+    /* A freshly truncated file is zero filled and ready to use. */
+    if (__atomic_load_n(&idcache_shm->magic, __ATOMIC_ACQUIRE) == 0) {
+        uint32_t zero = 0;
+
+        idcache_shm->version = IDCACHE_VERSION;
+        __atomic_compare_exchange_n(&idcache_shm->magic, &zero, IDCACHE_MAGIC,
+            0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+
+    if (idcache_shm->magic != IDCACHE_MAGIC ||
+        idcache_shm->version != IDCACHE_VERSION) {
+        munmap(p, sizeof(struct idcache_shm));
+        idcache_shm = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Map the state file once, returns -1 if the cache is disabled. */
+static int _idcache_init (void) {
+    int state = __atomic_load_n(&idcache_state, __ATOMIC_ACQUIRE);
+
+    if (state == 2) return 0;
+    if (state != 0) return -1;
+
+    /* Only one thread attempts the mapping. */
+    if (!__atomic_compare_exchange_n(&idcache_state, &state, 1, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return state == 2 ? 0 : -1;
+    }
+
+    if (_idcache_map()) {
+        __atomic_store_n(&idcache_state, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    __atomic_store_n(&idcache_state, 2, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* First slot probed for a uid. */
+static uint32_t _idcache_hash (uid_t uid) {
+    return ((uint32_t) uid * 0x9e3779b1U) & (IDCACHE_NSLOTS - 1);
+}
+
+/* Look a uid up, returns 0 on a fresh hit. */
+static int _idcache_lookup (uid_t uid, uint64_t now, gid_t *gid, char *name,
+        size_t namelen) {
+    uint32_t h = _idcache_hash(uid);
+    int i;
+
+    for (i = 0; i < IDCACHE_NPROBES; i++) {
+        struct idcache_slot *s =
+            &idcache_shm->slot[(h + i) & (IDCACHE_NSLOTS - 1)];
+        char buf[IDCACHE_NAME_LEN];
+        uint32_t seq, suid, sgid;
+        uint64_t expires;
+
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+
+        /* Being written, do not wait for it. */
+        if (seq & 1) continue;
+
+        suid = __atomic_load_n(&s->uid, __ATOMIC_RELAXED);
+        sgid = __atomic_load_n(&s->gid, __ATOMIC_RELAXED);
+        expires = __atomic_load_n(&s->expires, __ATOMIC_RELAXED);
+        memcpy(buf, s->name, sizeof(buf));
+
+        /* The copy is only good if no writer came in between. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) continue;
+
+        if (expires == 0 || suid != (uint32_t) uid) continue;
+        if (expires <= now) return -1;
+
+        buf[IDCACHE_NAME_LEN - 1] = '\0';
+
+        if (name && strlen(buf) >= namelen) return -1;
+
+        *gid = sgid;
+        if (name) strcpy(name, buf);
+
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Store a user, in its own slot, a free or expired one, or else the one
+ * that expires first. */
+static void _idcache_insert (uid_t uid, gid_t gid, const char *name,
+        uint64_t now) {
+    uint32_t h = _idcache_hash(uid);
+    struct idcache_slot *victim = NULL;
+    uint64_t oldest = UINT64_MAX;
+    uint32_t seq;
+    int i;
+
+    if (strlen(name) >= IDCACHE_NAME_LEN) return;
+
+    for (i = 0; i < IDCACHE_NPROBES; i++) {
+        struct idcache_slot *s =
+            &idcache_shm->slot[(h + i) & (IDCACHE_NSLOTS - 1)];
+        uint64_t expires = __atomic_load_n(&s->expires, __ATOMIC_RELAXED);
+
+        if (__atomic_load_n(&s->uid, __ATOMIC_RELAXED) == (uint32_t) uid &&
+            expires) {
+            victim = s;
+            break;
+        }
+
+        if (expires <= now) expires = 0;
+
+        if (expires < oldest) {
+            oldest = expires;
+            victim = s;
+        }
+    }
+
+    /* Claim the slot, leave it to the other writer if there is one. */
+    seq = __atomic_load_n(&victim->seq, __ATOMIC_ACQUIRE);
+
+    if ((seq & 1) || !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1,
+        0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    __atomic_store_n(&victim->uid, (uint32_t) uid, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->gid, (uint32_t) gid, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->expires, now + IDCACHE_TTL, __ATOMIC_RELAXED);
+    memset(victim->name, 0, IDCACHE_NAME_LEN);
+    memcpy(victim->name, name, strlen(name));
+
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int idcache_getuid (uid_t uid, gid_t *gid, char *name, size_t namelen) {
+    struct passwd pwd, *result = NULL;
+    size_t buflen = 16384;
+    char *buf = NULL;
+    uint64_t now = time(NULL);
+    int cached = _idcache_init() == 0;
+    int rv;
+
+    if (cached && _idcache_lookup(uid, now, gid, name, namelen) == 0) {
+        return 0;
+    }
+
+    /* Miss, ask NSS, growing the buffer as needed. */
+    for (;;) {
+        char *tmp = realloc(buf, buflen);
+
+        if (tmp == NULL) {
+            free(buf);
+            errno = ENOMEM;
+            return -1;
+        }
+
+        buf = tmp;
+        rv = getpwuid_r(uid, &pwd, buf, buflen, &result);
+
+        if (rv != ERANGE || buflen >= 1048576) break;
+
+        buflen *= 2;
+    }
+
+    if (result == NULL) {
+        free(buf);
+        errno = rv ? rv : ENOENT;
+        return -1;
+    }
+
+    if (name && strlen(pwd.pw_name) >= namelen) {
+        free(buf);
+        errno = ERANGE;
+        return -1;
+    }
+
+    *gid = pwd.pw_gid;
+    if (name) strcpy(name, pwd.pw_name);
+
+    if (cached) _idcache_insert(uid, pwd.pw_gid, pwd.pw_name, now);
+
+    free(buf);
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * idcache.h: Node local uid to (gid, user name) cache shared by all plugins.
+ *
+ * Looking up a user goes to NSS, often SSSD or LDAP, which can take from tens
+ * to hundreds of milliseconds when many jobs start at once.  Entries are kept
+ * for IDCACHE_TTL seconds in a small mmap'd file, so that they outlive the
+ * slurmstepd processes the plugins run in, and shared by all of them.
+ *
+ * The table is open addressing, each slot protected by its own sequence
+ * counter (seqlock): readers never block nor write, a writer claims the slot
+ * with a compare-and-swap and gives up if another one holds it.  Anything
+ * that goes wrong (no state file, slot busy, name too long) falls back to
+ * getpwuid_r().
+ *
+ * The state file has to be writable by the daemon, e.g. root for slurmd.
+ * Otherwise the cache is silently disabled.
+ *
+ */
+
+#ifndef _IDCACHE_H
+#define _IDCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Location of the state file. */
+#ifndef IDCACHE_PATH
+#define IDCACHE_PATH "/run/slurm_plugins.idcache"
+#endif
+
+/* Seconds an entry is trusted for. */
+#ifndef IDCACHE_TTL
+#define IDCACHE_TTL 600
+#endif
+
+#define IDCACHE_MAGIC 0x43495053  /* "SPIC" */
+#define IDCACHE_VERSION 1
+#define IDCACHE_NSLOTS 4096     /* A power of 2. */
+#define IDCACHE_NPROBES 8       /* Slots probed per lookup. */
+#define IDCACHE_NAME_LEN 40
+
+/* One cached user, a cache line. */
+struct idcache_slot {
+    uint32_t seq;           /* Odd while being written. */
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t pad;
+    uint64_t expires;       /* Wall clock seconds, 0 = empty. */
+    char name[IDCACHE_NAME_LEN];
+};
+
+/* Layout of the state file. */
+struct idcache_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pad[14];
+    struct idcache_slot slot[IDCACHE_NSLOTS];
+};
+
+/* Get the primary gid and, if name is not NULL, the user name of a uid.
+ * Returns 0 on success, -1 with errno set (ENOENT for an unknown uid). */
+int idcache_getuid(uid_t uid, gid_t *gid, char *name, size_t namelen);
+
+#endif /* _IDCACHE_H */
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * job_replay.c: Build a replayable submission trace from the job script
+ * archive and play it back.
+ *
+ * The archive is the one written by job_submit_collect_script and
+ * spank_collect_script: one directory per day ("%Y-%m-%d") holding job<id>
+ * or job<id>.script files, plus job<id>.workdir when known.  The file
+ * modification time is taken as the submission time, and partition, GRES and
+ * CPU count are taken from the #SBATCH directives of each script.  The job
+ * user is looked up from the USER (or LOGNAME) variable of the
+ * job<id>.environment file that script_harvester archives, it is unknown for
+ * the other jobs.
+ *
+ * Only the job<id>.script files of script_harvester, copied with their
+ * original mtime, carry both the real job id and the submission time.
+ * job_submit_collect_script runs before slurmctld assigns the job id, so it
+ * writes every job under the same unset id (NO_VAL) and keeps the first one
+ * only; those files are skipped.  spank_collect_script writes job<id> when
+ * the job starts, so jobs found only in that form are replayed at their start
+ * times, without their queue wait; the trace header tells how many there
+ * are.  A job found in both forms, possibly in different days, is taken once
+ * from job<id>.script.  A workdir with a tab or a newline in it cannot be
+ * written to the trace and is left out.
+ *
+ * A trace (see replay_trace.h) is played back either by running a command for
+ * every job at the original inter-arrival times, scaled by a speed factor, e.g.
+ * sbatch against a local stand-in slurmctld (SLURM_CONF=...), or by
+ * "plugin_bench -r trace" to feed the jobs straight into a job_submit plugin.
+ *
+ * gcc -o job_replay job_replay.c replay_trace.c
+ *
+ * Usage: job_replay -g -d archive_dir [-f from_date] [-t to_date] > trace
+ *        job_replay -r trace [-x speed] [-c command] [-n]
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "replay_trace.h"
+
+
+const char *myname = "job_replay";
+
+/* A job found in the archive, before sorting by submission time. */
+struct archived_job {
+    uint64_t mtime_us;
+    int submitted;          /* From job<id>.script, mtime is the submission. */
+    struct replay_job job;
+};
+
+
+/* Print usage. */
+void _usage (void) {
+    fprintf(stderr,
+        "Usage: %s -g -d archive_dir [-f from_date] [-t to_date] > trace\n"
+        "       %s -r trace [-x speed] [-c command] [-n]\n"
+        "\n"
+        "  -g  generate a trace from the archive, dates are %%Y-%%m-%%d\n"
+        "  -r  play a trace back by running \"command script\" in the job's\n"
+        "      workdir for every job (default command: sbatch)\n"
+        "  -x  playback speed factor, 0 submits as fast as possible\n"
+        "  -n  print the jobs instead of running the command\n",
+        myname, myname);
+}
+
+/* A daily directory name is "%Y-%m-%d". */
+int _is_date (const char *s) {
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        if (i == 4 || i == 7 ? s[i] != '-' : !isdigit((unsigned char) s[i]))
+            return 0;
+    }
+
+    return s[10] == '\0';
+}
+
+/* Match "job<id>" and "job<id>.script", return the job id or -1.  submitted
+ * is set for the latter. */
+long _script_jobid (const char *name, int *submitted) {
+    char *end;
+    long id;
+
+    if (strncmp(name, "job", 3) != 0 || !isdigit((unsigned char) name[3]))
+        return -1;
+
+    id = strtol(name + 3, &end, 10);
+    *submitted = *end != '\0';
+
+    return (*end == '\0' || strcmp(end, ".script") == 0) ? id : -1;
+}
+
+/* The job user, from the USER or LOGNAME variable of an archived environment
+ * (NUL separated "name=value" after a binary header), REPLAY_NO_UID if there
+ * is none. */
+uint32_t _env_uid (const char *path) {
+    const char *vars[2] = {"USER=", "LOGNAME="};
+    struct passwd *pw = NULL;
+    char *env, *p = NULL;
+    long size;
+    int i;
+
+    env = replay_read_file(path, &size);
+
+    if (env == NULL) return REPLAY_NO_UID;
+
+    for (i = 0; i < 2 && p == NULL; i++) {
+        size_t len = strlen(vars[i]);
+
+        for (p = env; (p = memmem(p, env + size - p, vars[i], len)) != NULL;
+             p++) {
+            if (p == env || p[-1] == '\0') break;
+        }
+
+        if (p) pw = getpwnam(p + len);
+    }
+
+    free(env);
+
+    return pw ? pw->pw_uid : REPLAY_NO_UID;
+}
+
+/* qsort comparator, by submission time. */
+int _cmp (const void *a, const void *b) {
+    uint64_t x = ((const struct archived_job *) a)->mtime_us;
+    uint64_t y = ((const struct archived_job *) b)->mtime_us;
+
+    return x < y ? -1 : x > y;
+}
+
+/* qsort comparator, by job id, submission times first. */
+int _cmp_jobid (const void *a, const void *b) {
+    const struct archived_job *x = a;
+    const struct archived_job *y = b;
+
+    if (x->job.jobid != y->job.jobid) {
+        return x->job.jobid < y->job.jobid ? -1 : 1;
+    }
+
+    return y->submitted - x->submitted;
+}
+
+/* Scan the archive between two dates and print the trace. */
+int _generate (const char *base, const char *from, const char *to) {
+    struct archived_job *jobs = NULL;
+    long njobs = 0, max = 0, nstarted = 0, i, n;
+    struct dirent *de;
+    DIR *dir;
+
+    dir = opendir(base);
+
+    if (dir == NULL) {
+        fprintf(stderr, "%s: Unable to open %s: %m\n", myname, base);
+        return 1;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        char day[PATH_MAX];
+        struct dirent *fe;
+        DIR *ddir;
+
+        if (!_is_date(de->d_name)) continue;
+        if (from && strcmp(de->d_name, from) < 0) continue;
+        if (to && strcmp(de->d_name, to) > 0) continue;
+
+        snprintf(day, PATH_MAX, "%s/%s", base, de->d_name);
+        ddir = opendir(day);
+
+        if (ddir == NULL) {
+            fprintf(stderr, "%s: Unable to open %s: %m\n", myname, day);
+            continue;
+        }
+
+        while ((fe = readdir(ddir)) != NULL) {
+            char path[PATH_MAX];
+            struct replay_job *job;
+            struct stat st;
+            char *script;
+            int submitted;
+            long id = _script_jobid(fe->d_name, &submitted);
+
+            /* NO_VAL, job_submit_collect_script had no id (see above). */
+            if (id < 0 || id == 0xfffffffe) continue;
+
+            snprintf(path, PATH_MAX, "%s/%s", day, fe->d_name);
+
+            if (stat(path, &st) || (script = replay_read_file(path, NULL)) == NULL) {
+                fprintf(stderr, "%s: Unable to read %s: %m\n", myname, path);
+                continue;
+            }
+
+            if (njobs == max) {
+                struct archived_job *tmp;
+
+                max = max ? max * 2 : 1024;
+                tmp = realloc(jobs, max * sizeof(*jobs));
+
+                if (tmp == NULL) {
+                    fprintf(stderr, "%s: Unable to allocate memory\n", myname);
+                    return 1;
+                }
+
+                jobs = tmp;
+            }
+
+            memset(&jobs[njobs], 0, sizeof(*jobs));
+            jobs[njobs].mtime_us = st.st_mtim.tv_sec * 1000000ULL +
+                st.st_mtim.tv_nsec / 1000;
+            jobs[njobs].submitted = submitted;
+
+            job = &jobs[njobs].job;
+            job->jobid = id;
+            job->script = strdup(path);
+            replay_parse_script(script, job);
+            free(script);
+
+            /* The workdir is saved next to the script, without a newline. */
+            snprintf(path, PATH_MAX, "%s/job%ld.workdir", day, id);
+            job->workdir = replay_read_file(path, NULL);
+
+            if (job->workdir && strpbrk(job->workdir, "\t\n\r")) {
+                fprintf(stderr, "%s: %s has a tab or newline, ignored\n",
+                    myname, path);
+                free(job->workdir);
+                job->workdir = NULL;
+            }
+
+            snprintf(path, PATH_MAX, "%s/job%ld.environment", day, id);
+            job->uid = _env_uid(path);
+
+            njobs++;
+        }
+
+        closedir(ddir);
+    }
+
+    closedir(dir);
+
+    /* Keep one copy of every job, the one with its submission time. */
+    qsort(jobs, njobs, sizeof(*jobs), _cmp_jobid);
+
+    for (i = 0, n = 0; i < njobs; i++) {
+        if (n > 0 && jobs[i].job.jobid == jobs[n - 1].job.jobid) {
+            free(jobs[i].job.partition);
+            free(jobs[i].job.gres);
+            free(jobs[i].job.script);
+            free(jobs[i].job.workdir);
+            continue;
+        }
+
+        if (!jobs[i].submitted) nstarted++;
+        jobs[n++] = jobs[i];
+    }
+
+    njobs = n;
+
+    qsort(jobs, njobs, sizeof(*jobs), _cmp);
+
+    printf("# %s trace of %s from %s to %s, %ld jobs, %ld at start time\n",
+        myname, base, from ? from : "-", to ? to : "-", njobs, nstarted);
+
+    for (i = 0; i < njobs; i++) {
+        jobs[i].job.offset_us = jobs[i].mtime_us - jobs[0].mtime_us;
+        replay_write(stdout, &jobs[i].job);
+    }
+
+    return 0;
+}
+
+/* Monotonic clock in microseconds. */
+uint64_t _now_us (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Sleep for a number of microseconds, usleep() is limited to 32 bits. */
+void _sleep_us (uint64_t us) {
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+/* Reap finished submissions, count the failed ones. */
+void _reap (int flags, long *nrunning, long *nfail) {
+    int status;
+
+    while (*nrunning > 0 && waitpid(-1, &status, flags) > 0) {
+        (*nrunning)--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) (*nfail)++;
+    }
+}
+
+/* Play a trace back through a command. */
+int _play (const char *path, double speed, char *command, int dry_run) {
+    struct replay_job *jobs;
+    long njobs, i, nrunning = 0, nfail = 0;
+    uint64_t t0, lag, max_lag = 0, sum_lag = 0;
+    char *argv[64];
+    int argc = 0;
+    char *tok;
+
+    njobs = replay_load(path, &jobs);
+
+    if (njobs < 0) {
+        fprintf(stderr, "%s: Unable to load %s: %m\n", myname, path);
+        return 1;
+    }
+
+    for (tok = strtok(command, " "); tok && argc < 62; tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+
+    t0 = _now_us();
+
+    for (i = 0; i < njobs; i++) {
+        uint64_t due = t0 + (speed > 0 ? jobs[i].offset_us / speed : 0);
+        uint64_t now = _now_us();
+        pid_t pid;
+
+        if (due > now) {
+            _sleep_us(due - now);
+            now = _now_us();
+        }
+
+        lag = now > due ? now - due : 0;
+        sum_lag += lag;
+        if (lag > max_lag) max_lag = lag;
+
+        if (dry_run) {
+            printf("%.6f\t", (now - t0) / 1e6);
+            replay_write(stdout, &jobs[i]);
+            continue;
+        }
+
+        argv[argc] = jobs[i].script;
+        argv[argc + 1] = NULL;
+
+        pid = fork();
+
+        if (pid == 0) {
+            if (jobs[i].workdir && chdir(jobs[i].workdir)) {
+                /* Fall back to the current directory. */
+            }
+            execvp(argv[0], argv);
+            _exit(127);
+        }
+
+        if (pid < 0) {
+            nfail++;
+        } else {
+            nrunning++;
+        }
+
+        _reap(WNOHANG, &nrunning, &nfail);
+    }
+
+    _reap(0, &nrunning, &nfail);
+
+    fprintf(stderr, "%s: %ld jobs in %.3f s, %ld failed, lag avg %.1f ms, "
+        "max %.1f ms\n", myname, njobs, (_now_us() - t0) / 1e6, nfail,
+        njobs ? sum_lag / 1e3 / njobs : 0, max_lag / 1e3);
+
+    replay_free(jobs, njobs);
+
+    return nfail ? 1 : 0;
+}
+
+int main (int argc, char **argv) {
+    const char *base = NULL, *from = NULL, *to = NULL, *trace = NULL;
+    char command[PATH_MAX] = "sbatch";
+    double speed = 1.0;
+    int generate = 0, dry_run = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "gd:f:t:r:x:c:nh")) != -1) {
+        switch (opt) {
+        case 'g':
+            generate = 1;
+            break;
+        case 'd':
+            base = optarg;
+            break;
+        case 'f':
+            from = optarg;
+            break;
+        case 't':
+            to = optarg;
+            break;
+        case 'r':
+            trace = optarg;
+            break;
+        case 'x':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'c':
+            snprintf(command, sizeof(command), "%s", optarg);
+            break;
+        case 'n':
+            dry_run = 1;
+            break;
+        default:
+            _usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (generate && base) return _generate(base, from, to);
+    if (!generate && trace) return _play(trace, speed, command, dry_run);
+
+    _usage();
+
+    return 1;
+}
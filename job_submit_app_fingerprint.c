@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * job_submit_app_fingerprint: Job Submit plugin to tag jobs with the
+ *      applications their script runs.
+ *
+ * The signature file (see acmatch.h for the format) is compiled once in
+ * init() and every job script is scanned once for all signatures.  The tags
+ * found are set in the job's admin_comment as "app=VASP,PyTorch", replacing
+ * the "app=" token of an earlier submission of the same job, and leaving the
+ * rest of the comment alone.  This does not depend on the script being
+ * archived, the plugin can be stacked with job_submit_collect_script or used
+ * on its own.
+ *
+ * Note you will need to change the definition of "signature_file" in the
+ * following code to meet your own requirement.  Without the file the plugin
+ * does nothing.
+ *
+ * gcc -shared -fPIC -pthread -I${SLURM_SRC_DIR}
+ *     job_submit_app_fingerprint.c acmatch.c trace.c
+ *     -o job_submit_app_fingerprint.so
+ *
+ */
+
+#include <limits.h>
+#include <slurm/slurm_errno.h>
+#include "src/slurmctld/slurmctld.h"
+#include "acmatch.h"
+#include "trace.h"
+
+/* Required by Slurm job_submit plugin interface. */
+const char plugin_name[] = "Tag jobs with their applications";
+const char plugin_type[] = "job_submit/app_fingerprint";
+const uint32_t plugin_version = SLURM_VERSION_NUMBER;
+
+/* Global variables. */
+const char *myname = "job_submit_app_fingerprint";
+/* Application signatures - need to modify. */
+const char *signature_file = "/etc/slurm/app_signatures.conf";
+
+/* Compiled signatures, NULL if fingerprinting is disabled. */
+struct acm *signatures = NULL;
+
+
+/* Remove the "app=" tokens and trailing blanks from a comment, in place. */
+void _strip_app (char *comment) {
+    char *p = comment, *end;
+
+    while ((p = strstr(p, "app=")) != NULL) {
+        /* Only whole tokens, not e.g. "myapp=". */
+        if (p != comment && p[-1] != ' ') {
+            p += 4;
+            continue;
+        }
+
+        end = strchr(p, ' ');
+        end = end ? end + 1 : p + strlen(p);
+        memmove(p, end, strlen(end) + 1);
+    }
+
+    for (end = comment + strlen(comment); end > comment && end[-1] == ' ';
+        end--);
+    *end = '\0';
+}
+
+/* Tag the job with the applications found in its script. */
+void _fingerprint (struct job_descriptor *job_desc) {
+    uint8_t seen[ACM_MAX_TAGS / 8];
+    const char *sep = "app=";
+    int i, n;
+
+    memset(seen, 0, sizeof(seen));
+
+    trace_begin(TRACE_E_FINGERPRINT, job_desc->job_id);
+    n = acm_scan(signatures, job_desc->script, strlen(job_desc->script), seen);
+    trace_end(TRACE_E_FINGERPRINT, job_desc->job_id, n);
+
+    /* The script may have changed since the job was last tagged. */
+    if (job_desc->admin_comment) _strip_app(job_desc->admin_comment);
+
+    if (n == 0) return;
+
+    if (job_desc->admin_comment && job_desc->admin_comment[0]) {
+        xstrcat(job_desc->admin_comment, " ");
+    }
+
+    /* Straight into the comment, however many tags match. */
+    for (i = 0; i < signatures->ntags; i++) {
+        if (!(seen[i >> 3] & (1 << (i & 7)))) continue;
+
+        xstrcat(job_desc->admin_comment, sep);
+        xstrcat(job_desc->admin_comment, signatures->tags[i]);
+        sep = ",";
+    }
+}
+
+/* Called once when slurmctld loads the plugin. */
+extern int init(void) {
+    char err[PATH_MAX];
+
+    signatures = acm_load(signature_file, err, sizeof(err));
+
+    if (signatures == NULL) {
+        info("%s: %s, application fingerprinting disabled", myname, err);
+    } else {
+        info("%s: %d application tags loaded from %s", myname,
+            signatures->ntags, signature_file);
+    }
+
+    return SLURM_SUCCESS;
+}
+
+extern void fini(void) {
+    acm_free(signatures);
+    signatures = NULL;
+}
+
+extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
+        char **err_msg) {
+    /* Nothing to scan, e.g. srun and salloc jobs. */
+    if (signatures == NULL || job_desc->script == NULL) return SLURM_SUCCESS;
+
+    trace_init(TRACE_P_JOB_SUBMIT_APP_FINGERPRINT);
+    _fingerprint(job_desc);
+
+    return SLURM_SUCCESS;
+}
+
+extern int job_modify(struct job_descriptor *job_desc,
+        struct job_record *job_ptr, uint32_t submit_uid) {
+    return SLURM_SUCCESS;
+}
@@ -10,13 +10,15 @@
  * location where the job scripts should be stored into.
  *
  * gcc -shared -fPIC -pthread -I${SLURM_SRC_DIR}
- *     job_submit_collect_script.c -o job_submit_collect_script.so
+ *     job_submit_collect_script.c metrics.c trace.c -o job_submit_collect_script.so
  *
  */
 
 #include <limits.h>
 #include <slurm/slurm_errno.h>
 #include "src/slurmctld/slurmctld.h"
+#include "metrics.h"
+#include "trace.h"
 
 /* Required by Slurm job_submit plugin interface. */
 const char plugin_name[] = "Collect job script and workdir";
@@ -58,6 +60,10 @@ int _get_datestr (char *ds, int len) {
     return 0;
 }
 
+extern void fini(void) {
+    metrics_fini();
+}
+
 extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
         char **err_msg) {
     /* TODO: job_desc->job_id is not available at submit time, so no way to
@@ -68,8 +74,12 @@ extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
     char target_script[PATH_MAX];   /* Target job script filename. */
     char target_workdir[PATH_MAX];  /* Target workdir filename. */
     FILE *fd = NULL;    /* File handle for write. */
+    double t0;          /* Start time of the script write. */
     int rv;
 
+    trace_init(TRACE_P_JOB_SUBMIT_COLLECT_SCRIPT);
+    metrics_init(METRICS_SLURMCTLD);
+
     /* If job script is not available no need to proceed. */
     if (job_desc->script == NULL) return SLURM_SUCCESS;
 
@@ -121,11 +131,15 @@ extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
         return ESLURM_INTERNAL;
     }
 
+    trace_begin(TRACE_E_SCRIPT_WRITE, jobid);
+    t0 = metrics_now();
+
     /* Open the target file for write. */
     fd = fopen(target_script, "wb");
 
     if (fd == NULL) {
         info("%s: Unable to open %s: %m", myname, target_script);
+        trace_end(TRACE_E_SCRIPT_WRITE, jobid, 0);
         return ESLURM_INTERNAL;
     }
 
@@ -134,19 +148,28 @@ extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
 
     if (ferror(fd)) {
         info("%s: Error on writing %s: %m", myname, target_script);
+        trace_end(TRACE_E_SCRIPT_WRITE, jobid, 0);
         return ESLURM_WRITING_TO_FILE;
     }
 
     /* Close the target file. */
     fclose(fd);
 
+    trace_end(TRACE_E_SCRIPT_WRITE, jobid, strlen(job_desc->script));
+    metrics_observe(M_SCRIPT_WRITE_SECONDS, metrics_now() - t0);
+    metrics_add(M_SCRIPTS_COLLECTED, NULL, 1);
+    metrics_add(M_SCRIPT_BYTES, NULL, strlen(job_desc->script));
+
     info("%s: Job script saved as %s", myname, target_script);
 
+    trace_begin(TRACE_E_WORKDIR_WRITE, jobid);
+
     /* Open the target file for write. */
     fd = fopen(target_workdir, "wb");
 
     if (fd == NULL) {
         info("%s: Unable to open %s: %m", myname, target_workdir);
+        trace_end(TRACE_E_WORKDIR_WRITE, jobid, 0);
         return ESLURM_INTERNAL;
     }
 
@@ -155,12 +178,15 @@ extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
 
     if (ferror(fd)) {
         info("%s: Error on writing %s: %m", myname, target_workdir);
+        trace_end(TRACE_E_WORKDIR_WRITE, jobid, 0);
         return ESLURM_WRITING_TO_FILE;
     }
 
     /* Close the target file. */
     fclose(fd);
 
+    trace_end(TRACE_E_WORKDIR_WRITE, jobid, strlen(job_desc->work_dir));
+
     info("%s: Job workdir saved as %s", myname, target_workdir);
 
     return SLURM_SUCCESS;
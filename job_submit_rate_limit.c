@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * job_submit_rate_limit: Job Submit plugin to limit the submission rate of
+ *      each user.
+ *
+ * This plugin keeps a token bucket per submitting user: "burst" submissions
+ * are allowed at once, refilled at "rate" submissions per second.  Jobs over
+ * the limit are rejected with an explanation, or if "defer" is set accepted
+ * with their begin time pushed "defer" seconds later, so that a runaway
+ * workflow cannot starve slurmctld for everyone else.  root and SlurmUser are
+ * exempt.
+ *
+ * The buckets live in a fixed open addressing table of 64-bit words, one per
+ * active user, updated with a single compare-and-swap and no locks.  A word
+ * holds the uid and the bucket as a theoretical arrival time (GCRA, which is
+ * equivalent to a token bucket): the time at which the bucket would be full
+ * again.  A user whose bucket is full has no state worth keeping, so the slot
+ * can be taken over by another user, and memory stays constant.
+ *
+ * Note you will need to change the definition of "rate", "burst" and "defer"
+ * in the following code to meet your own requirement.
+ *
+ * gcc -shared -fPIC -pthread -I${SLURM_SRC_DIR}
+ *     job_submit_rate_limit.c trace.c -o job_submit_rate_limit.so
+ *
+ */
+
+#include <limits.h>
+#include <slurm/slurm_errno.h>
+#include "src/slurmctld/slurmctld.h"
+#include "trace.h"
+
+/* Required by Slurm job_submit plugin interface. */
+const char plugin_name[] = "Per user submission rate limit";
+const char plugin_type[] = "job_submit/rate_limit";
+const uint32_t plugin_version = SLURM_VERSION_NUMBER;
+
+/* Global variables. */
+const char *myname = "job_submit_rate_limit";
+
+/* Sustained submissions per second allowed per user - need to modify. */
+const double rate = 10.0;
+/* Submissions allowed at once on top of the rate - need to modify. */
+const uint32_t burst = 200;
+/* Seconds to defer jobs over the limit by, 0 to reject them - need to
+ * modify. */
+const uint32_t defer = 0;
+
+/* Number of slots of the bucket table, a power of 2, and the number of slots
+ * probed per lookup.  Users beyond that are not limited. */
+#define RL_NSLOTS 4096
+#define RL_NPROBES 32
+
+/* Bucket table, a slot is (uid + 1) << 32 | tat, 0 if never used.  tat is
+ * the theoretical arrival time in milliseconds of the monotonic clock, modulo
+ * 2^32, and is compared to the current time as a signed difference. */
+uint64_t rl_slots[RL_NSLOTS];
+
+
+/* Monotonic clock in milliseconds, modulo 2^32. */
+uint32_t _now_ms (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t) (ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+/* Charge one submission to the bucket of uid.  Returns 0 if it is within the
+ * limit, otherwise the number of milliseconds until it would be. */
+uint32_t _rate_limit (uint32_t uid) {
+    uint32_t interval = 1000 / rate;                /* ms per submission. */
+    uint32_t tolerance = interval * (burst ? burst - 1 : 0);
+    uint32_t h = (uid * 0x9e3779b1U) & (RL_NSLOTS - 1);
+    uint64_t key = (uint64_t) (uid + 1ULL) << 32;
+    uint64_t *slot = NULL, old = 0, new;
+    uint32_t now, tat;
+    int32_t ahead;
+    int i;
+
+    /* (uid + 1) would not fit in 32 bits. */
+    if (uid == UINT32_MAX) return 0;
+    if (interval == 0) interval = 1;
+
+    for (;;) {
+        uint64_t *free_slot = NULL;
+
+        now = _now_ms();
+        slot = NULL;
+
+        /* Look for the user, remember a free slot on the way. */
+        for (i = 0; i < RL_NPROBES; i++) {
+            uint64_t *s = &rl_slots[(h + i) & (RL_NSLOTS - 1)];
+            uint64_t v = __atomic_load_n(s, __ATOMIC_ACQUIRE);
+
+            if ((v >> 32) == (key >> 32)) {
+                slot = s;
+                old = v;
+                break;
+            }
+
+            /* Never used or full bucket, anything outside of the range a
+             * live bucket can be in counts as full (the clock wrapped). */
+            ahead = (int32_t) ((uint32_t) v - now);
+            if (free_slot == NULL &&
+                (v == 0 || ahead <= 0 || ahead > (int32_t) (tolerance + interval))) {
+                free_slot = s;
+                old = v;
+            }
+        }
+
+        if (slot == NULL) slot = free_slot;
+
+        /* Table full of throttled users, let it go. */
+        if (slot == NULL) return 0;
+
+        /* Two concurrent first submissions of a user may each claim a slot,
+         * that only gives the user one more burst. */
+        tat = (old >> 32) == (key >> 32) ? (uint32_t) old : now;
+        ahead = (int32_t) (tat - now);
+
+        if (ahead < 0 || ahead > (int32_t) (tolerance + interval)) {
+            tat = now;
+            ahead = 0;
+        }
+
+        /* Bucket empty. */
+        if (ahead > (int32_t) tolerance) {
+            return ahead - tolerance;
+        }
+
+        new = key | (uint32_t) (tat + interval);
+
+        if (__atomic_compare_exchange_n(slot, &old, new, 0, __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+    }
+}
+
+extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
+        char **err_msg) {
+    uint32_t wait_ms;
+    time_t begin;
+
+    /* root and SlurmUser are not limited. */
+    if (submit_uid == 0 || submit_uid == getuid()) return SLURM_SUCCESS;
+
+    wait_ms = _rate_limit(submit_uid);
+
+    if (wait_ms == 0) return SLURM_SUCCESS;
+
+    trace_init(TRACE_P_JOB_SUBMIT_RATE_LIMIT);
+    trace_event(TRACE_E_RATE_LIMIT, TRACE_INSTANT, job_desc->job_id,
+        submit_uid);
+
+    if (defer) {
+        begin = time(NULL) + defer;
+
+        if (job_desc->begin_time < begin) job_desc->begin_time = begin;
+
+        info("%s: uid %u over %g submissions/s, job deferred by %u s", myname,
+            submit_uid, rate, defer);
+
+        return SLURM_SUCCESS;
+    }
+
+    info("%s: uid %u over %g submissions/s, job rejected", myname, submit_uid,
+        rate);
+
+    if (err_msg) {
+        *err_msg = xstrdup_printf("Submission rate limit exceeded: %g jobs/s "
+            "with bursts of %u, retry in %.1f s", rate, burst, wait_ms / 1e3);
+    }
+
+    return ESLURM_SUBMISSIONS_DISABLED;
+}
+
+extern int job_modify(struct job_descriptor *job_desc,
+        struct job_record *job_ptr, uint32_t submit_uid) {
+    return SLURM_SUCCESS;
+}
@@ -12,7 +12,8 @@
  * following code to meet your own requirement.
  *
  * gcc -shared -fPIC -pthread -I${SLURM_SRC_DIR}
- *     job_submit_require_cpu_gpu_ratio.c -o job_submit_require_cpu_gpu_ratio.so
+ *     job_submit_require_cpu_gpu_ratio.c metrics.c trace.c
+ *     -o job_submit_require_cpu_gpu_ratio.so
  *
  */
 
@@ -20,6 +21,8 @@
 #include <regex.h>
 #include <slurm/slurm_errno.h>
 #include "src/slurmctld/slurmctld.h"
+#include "metrics.h"
+#include "trace.h"
 
 /* Required by Slurm job_submit plugin interface. */
 const char plugin_name[] = "Require CPU/GPU ratio";
@@ -30,6 +33,9 @@ const uint32_t plugin_version = SLURM_VERSION_NUMBER;
 const char *myname = "job_submit_require_cpu_gpu_ratio";
 /* GRES GPU regex. */
 const char *gpu_regex="^gpu:[_[:alnum:]:]*([[:digit:]]+)$";
+/* Compiled GPU regex, set up once in init(), regexec() is thread safe. */
+regex_t gpu_re;
+int gpu_re_ok = 0;
 
 /* Number of partitions to be checked - need to modify. */
 const int  npart = 2;
@@ -38,6 +44,16 @@ const char *mypart[2] = {"gpu", "gpu2"};
 /* The CPU/GPU ratio that is checked against - need to modify. */
 const int  ratio[2] = {2, 2};
 
+/* Outcome of the CPU/GPU rules, see _ratio_verdict(). */
+enum ratio_verdict {
+    RATIO_OK = 0,       /* Qualified, or partition not checked. */
+    RATIO_NO_GRES,      /* No GRES on a checked partition. */
+    RATIO_NO_GPU,       /* GRES without GPU. */
+    RATIO_BAD_GPU,      /* Invalid GPU number. */
+    RATIO_LOW_CPU,      /* Not enough CPUs per GPU. */
+    RATIO_ERROR         /* Unable to evaluate the GPU regex. */
+};
+
 
 /* Convert string to integer. */
 int _str2int (char *str, uint32_t *p2int) {
@@ -55,75 +71,147 @@ int _str2int (char *str, uint32_t *p2int) {
     return 0;
 }
 
-/* Check GRES to make sure CPU/GPU ratio meeting requirement. */
-int _check_ratio(char *part, char *gres, uint32_t ncpu) {
+/* Evaluate the CPU/GPU rules without logging.  *rule is set to the index of
+ * the partition rule that decided, *ngpu to the requested GPU number. */
+int _ratio_verdict (char *part, char *gres, uint32_t ncpu, int *rule,
+        uint32_t *ngpu) {
+    *rule = -1;
+    *ngpu = 0;
+
     if (part == NULL) {
-        info("%s: missed partition info", myname);
-        return SLURM_SUCCESS;
+        return RATIO_OK;
     }
 
     /* Loop through all partitions that need to be checked. */
     int i;
     for (i = 0; i < npart; i++) {
         if (strcmp(part, mypart[i]) == 0) {
+            *rule = i;
+
             /* Require GRES on a GRES partition. */
             if (gres == NULL) {
-                info("%s: missed GRES on partition %s", myname, mypart[i]);
-                return ESLURM_INVALID_GRES;
+                return RATIO_NO_GRES;
             } else {
-                regex_t re;
                 regmatch_t rm[2];
 
-                /* NUmber of GPUs. */
-                uint32_t ngpu = 0;
-
-                if (regcomp(&re, gpu_regex, REG_EXTENDED) != 0) {
-                    info("%s: failed to compile regex '%s': %m", myname, gpu_regex);
-                    return ESLURM_INTERNAL;
+                if (!gpu_re_ok) {
+                    return RATIO_ERROR;
                 }
 
-                int rv = regexec(&re, gres, 2, rm, 0);
-
-                regfree(&re);
+                int rv = regexec(&gpu_re, gres, 2, rm, 0);
 
                 if (rv == 0) { /* match */
                     /* Convert the GPU # to integer. */
-                    if (_str2int(gres + rm[1].rm_so, &ngpu) || ngpu < 1) {
-                        info("%s: invalid GPU number %s", myname, gres + rm[1].rm_so);
-                        return ESLURM_INVALID_GRES;
+                    if (_str2int(gres + rm[1].rm_so, ngpu) || *ngpu < 1) {
+                        return RATIO_BAD_GPU;
                     }
 
                     /* Sanity check of the CPU/GPU ratio. */
-                    if (ncpu / ngpu < ratio[i]) {
-                        info("%s: CPU=%zu, GPU=%zu, not qualify", myname, ncpu, ngpu);
-                        return ESLURM_INVALID_GRES;
+                    if (ncpu / *ngpu < ratio[i]) {
+                        return RATIO_LOW_CPU;
                     }
                 } else if (rv == REG_NOMATCH) { /* no match */
-                    info("%s: missed GPU on partition %s", myname, mypart[i]);
-                    return ESLURM_INVALID_GRES;
+                    return RATIO_NO_GPU;
                 } else { /* error */
-                    info("%s: failed to match regex '%s': %m", myname, gpu_regex);
-                    return ESLURM_INTERNAL;
+                    return RATIO_ERROR;
                 }
             }
         }
     }
 
+    return RATIO_OK;
+}
+
+/* Check GRES to make sure CPU/GPU ratio meeting requirement. */
+int _check_ratio(char *part, char *gres, uint32_t ncpu) {
+    uint32_t ngpu;
+    int rule;
+
+    if (part == NULL) {
+        info("%s: missed partition info", myname);
+        return SLURM_SUCCESS;
+    }
+
+    switch (_ratio_verdict(part, gres, ncpu, &rule, &ngpu)) {
+    case RATIO_NO_GRES:
+        info("%s: missed GRES on partition %s", myname, mypart[rule]);
+        return ESLURM_INVALID_GRES;
+    case RATIO_NO_GPU:
+        info("%s: missed GPU on partition %s", myname, mypart[rule]);
+        return ESLURM_INVALID_GRES;
+    case RATIO_BAD_GPU:
+        info("%s: invalid GPU number %s", myname, gres);
+        return ESLURM_INVALID_GRES;
+    case RATIO_LOW_CPU:
+        info("%s: CPU=%u, GPU=%u, not qualify", myname, ncpu, ngpu);
+        return ESLURM_INVALID_GRES;
+    case RATIO_ERROR:
+        info("%s: failed to evaluate regex '%s' on %s", myname, gpu_regex,
+            gres);
+        return ESLURM_INTERNAL;
+    }
+
+    return SLURM_SUCCESS;
+}
+
+extern int init(void) {
+    if (regcomp(&gpu_re, gpu_regex, REG_EXTENDED) != 0) {
+        info("%s: failed to compile regex '%s'", myname, gpu_regex);
+    } else {
+        gpu_re_ok = 1;
+    }
+
     return SLURM_SUCCESS;
 }
 
+extern void fini(void) {
+    if (gpu_re_ok) regfree(&gpu_re);
+    gpu_re_ok = 0;
+    metrics_fini();
+}
+
 extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
         char **err_msg) {
-    return _check_ratio(job_desc->partition,
-                        job_desc->gres,
-                        job_desc->min_cpus);
+    int rv;
+
+    trace_init(TRACE_P_JOB_SUBMIT_REQUIRE_CPU_GPU_RATIO);
+    trace_begin(TRACE_E_CHECK_RATIO, job_desc->job_id);
+
+    rv = _check_ratio(job_desc->partition,
+                      job_desc->gres,
+                      job_desc->min_cpus);
+
+    trace_end(TRACE_E_CHECK_RATIO, job_desc->job_id, rv);
+
+    /* Only jobs on a checked (thus named) partition can be rejected.  An
+     * internal error is not the user's doing, do not count it. */
+    if (rv == ESLURM_INVALID_GRES && metrics_init(METRICS_SLURMCTLD) == 0) {
+        metrics_add(M_RATIO_REJECTED, job_desc->partition, 1);
+    }
+
+    return rv;
 }
 
 extern int job_modify(struct job_descriptor *job_desc,
         struct job_record *job_ptr, uint32_t submit_uid) {
-    return _check_ratio(
-        job_desc->partition == NULL ? job_ptr->partition : job_desc->partition,
+    char *part = job_desc->partition == NULL ? job_ptr->partition :
+        job_desc->partition;
+    int rv;
+
+    trace_init(TRACE_P_JOB_SUBMIT_REQUIRE_CPU_GPU_RATIO);
+    trace_begin(TRACE_E_CHECK_RATIO, job_desc->job_id);
+
+    rv = _check_ratio(
+        part,
         job_desc->gres == NULL ? job_ptr->gres : job_desc->gres,
         job_desc->min_cpus == (uint32_t) -2 ? job_ptr->total_cpus :
              job_desc->min_cpus);
+
+    trace_end(TRACE_E_CHECK_RATIO, job_desc->job_id, rv);
+
+    if (rv == ESLURM_INVALID_GRES && metrics_init(METRICS_SLURMCTLD) == 0) {
+        metrics_add(M_RATIO_REJECTED, part, 1);
+    }
+
+    return rv;
 }
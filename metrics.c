@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * metrics.c: Prometheus counters and histograms shared by all plugins, see
+ * metrics.h.
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+
+/* Metric descriptions. */
+struct metrics_def {
+    const char *name;
+    const char *help;
+    const char *label;          /* Label name of labelled counters. */
+    const double *buckets;      /* Upper bounds of histogram buckets. */
+    int nbuckets;
+    int sides;                  /* Bitmask of sides exporting the metric. */
+};
+
+static const double seconds_buckets[] = {
+    0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10
+};
+
+static const double files_buckets[] = {
+    0, 1, 10, 100, 1000, 10000, 100000, 1000000
+};
+
+#define CTLD (1 << METRICS_SLURMCTLD)
+#define STEPD (1 << METRICS_SLURMSTEPD)
+
+static const struct metrics_def metrics_defs[M_MAX] = {
+    [M_RATIO_REJECTED] = {
+        "slurm_plugins_ratio_rejected_total",
+        "Jobs rejected by the CPU/GPU ratio check.",
+        "partition", NULL, 0, CTLD },
+    [M_SCRIPTS_COLLECTED] = {
+        "slurm_plugins_scripts_collected_total",
+        "Job scripts saved to the archive.",
+        NULL, NULL, 0, CTLD | STEPD },
+    [M_SCRIPT_BYTES] = {
+        "slurm_plugins_script_bytes_total",
+        "Bytes of job scripts written to the archive.",
+        NULL, NULL, 0, CTLD | STEPD },
+    [M_SCRIPT_WRITE_SECONDS] = {
+        "slurm_plugins_script_write_seconds",
+        "Time spent writing a job script to the archive.",
+        NULL, seconds_buckets, 11, CTLD | STEPD },
+    [M_TMP_CLEANUP_SECONDS] = {
+        "slurm_plugins_tmp_cleanup_seconds",
+        "Time spent removing private tmp and shm directories of a job.",
+        NULL, seconds_buckets, 11, STEPD },
+    [M_TMP_FILES_REMOVED] = {
+        "slurm_plugins_tmp_files_removed",
+        "Files removed from private tmp and shm directories per job.",
+        NULL, files_buckets, 8, STEPD },
+};
+
+static const char *metrics_side_names[METRICS_SIDE_MAX] = {
+    "slurmctld",
+    "slurmstepd",
+};
+
+/* Initialization state: 0 = not tried, 1 = in progress, 2 = ready,
+ * -1 = disabled. */
+static int metrics_state = 0;
+static int metrics_side = METRICS_SLURMCTLD;
+static struct metrics_shm *metrics_shm = NULL;
+
+/* Flusher thread, and the process it runs in as it does not survive fork(). */
+static pthread_t metrics_thread;
+static pid_t metrics_pid = 0;
+static int metrics_stop = 0;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metrics_cond = PTHREAD_COND_INITIALIZER;
+
+/* Set once this process has updated a metric. */
+static int metrics_dirty = 0;
+
+static void *_metrics_flusher(void *arg);
+
+
+/* Map the state file and initialize it if it is new. */
+static int _metrics_map (void) {
+    char path[PATH_MAX];
+    struct stat st;
+    void *p;
+    int fd, rv;
+
+    rv = snprintf(path, PATH_MAX, METRICS_STATE_PATH,
+        metrics_side_names[metrics_side]);
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        return -1;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) || ((size_t) st.st_size != sizeof(struct metrics_shm)
+        && ftruncate(fd, sizeof(struct metrics_shm)))) {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, sizeof(struct metrics_shm), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    metrics_shm = p;
+
+    /* A freshly truncated file is zero filled and ready to use. */
+    if (__atomic_load_n(&metrics_shm->magic, __ATOMIC_ACQUIRE) == 0) {
+        uint32_t zero = 0;
+
+        metrics_shm->version = METRICS_VERSION;
+        __atomic_compare_exchange_n(&metrics_shm->magic, &zero, METRICS_MAGIC,
+            0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+
+    if (metrics_shm->magic != METRICS_MAGIC ||
+        metrics_shm->version != METRICS_VERSION) {
+        munmap(p, sizeof(struct metrics_shm));
+        metrics_shm = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int metrics_init (int side) {
+    int state = __atomic_load_n(&metrics_state, __ATOMIC_ACQUIRE);
+    sigset_t all, old;
+
+    if (state == 2) return 0;
+    if (state != 0) return -1;
+
+    /* Only one thread attempts the mapping. */
+    if (!__atomic_compare_exchange_n(&metrics_state, &state, 1, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return state == 2 ? 0 : -1;
+    }
+
+    metrics_side = side;
+
+    if (side < 0 || side >= METRICS_SIDE_MAX || _metrics_map()) {
+        __atomic_store_n(&metrics_state, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    /* Flush slurmctld's metrics in the background, signals are left to the
+     * daemon's threads.  A slurmstepd does not live long enough for the
+     * thread to be worth it, metrics_fini() writes the textfile instead. */
+    if (side == METRICS_SLURMCTLD) {
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        metrics_stop = 0;
+
+        if (pthread_create(&metrics_thread, NULL, _metrics_flusher, NULL) == 0) {
+            metrics_pid = getpid();
+        }
+
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+
+    __atomic_store_n(&metrics_state, 2, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Write all series of the current side into the textfile. */
+static int _metrics_write (void) {
+    const char *side = metrics_side_names[metrics_side];
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    FILE *fd;
+    int i, j, rv;
+
+    rv = snprintf(path, PATH_MAX, METRICS_TEXTFILE_PATH, side);
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        return -1;
+    }
+
+    /* node_exporter must never see a partial file. */
+    rv = snprintf(tmp, PATH_MAX, "%s.%d", path, getpid());
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        return -1;
+    }
+
+    fd = fopen(tmp, "w");
+
+    if (fd == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < M_MAX; i++) {
+        const struct metrics_def *d = &metrics_defs[i];
+
+        if (!(d->sides & (1 << metrics_side))) continue;
+
+        fprintf(fd, "# HELP %s %s\n", d->name, d->help);
+
+        if (d->buckets) {
+            struct metrics_hist *h = &metrics_shm->hist[i];
+            uint64_t cum = 0;
+
+            fprintf(fd, "# TYPE %s histogram\n", d->name);
+
+            for (j = 0; j < d->nbuckets; j++) {
+                cum += __atomic_load_n(&h->bucket[j], __ATOMIC_RELAXED);
+                fprintf(fd, "%s_bucket{le=\"%g\"} %llu\n", d->name,
+                    d->buckets[j], (unsigned long long) cum);
+            }
+
+            cum += __atomic_load_n(&h->bucket[j], __ATOMIC_RELAXED);
+            fprintf(fd, "%s_bucket{le=\"+Inf\"} %llu\n", d->name,
+                (unsigned long long) cum);
+            fprintf(fd, "%s_sum %.6f\n", d->name,
+                __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e6);
+            fprintf(fd, "%s_count %llu\n", d->name, (unsigned long long)
+                __atomic_load_n(&h->count, __ATOMIC_RELAXED));
+        } else if (d->label) {
+            fprintf(fd, "# TYPE %s counter\n", d->name);
+
+            for (j = 0; j < METRICS_NLABELS; j++) {
+                struct metrics_label *l = &metrics_shm->label[j];
+
+                if (__atomic_load_n(&l->state, __ATOMIC_ACQUIRE) != 2 ||
+                    l->id != i) continue;
+
+                fprintf(fd, "%s{%s=\"%s\"} %llu\n", d->name, d->label,
+                    l->label, (unsigned long long)
+                    __atomic_load_n(&l->value, __ATOMIC_RELAXED));
+            }
+        } else {
+            fprintf(fd, "# TYPE %s counter\n", d->name);
+            fprintf(fd, "%s %llu\n", d->name, (unsigned long long)
+                __atomic_load_n(&metrics_shm->counter[i], __ATOMIC_RELAXED));
+        }
+    }
+
+    if (fclose(fd) || rename(tmp, path)) {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Flush if METRICS_INTERVAL has passed, only one process wins. */
+static void _metrics_maybe_flush (void) {
+    struct timespec ts;
+    uint64_t last;
+
+    /* The coarse clock is served from the vDSO, no syscall. */
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+    last = __atomic_load_n(&metrics_shm->last_flush, __ATOMIC_RELAXED);
+
+    if ((uint64_t) ts.tv_sec < last + METRICS_INTERVAL) return;
+
+    if (__atomic_compare_exchange_n(&metrics_shm->last_flush, &last,
+        (uint64_t) ts.tv_sec, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        _metrics_write();
+    }
+}
+
+/* Wake up every METRICS_INTERVAL seconds until metrics_fini(). */
+static void *_metrics_flusher (void *arg) {
+    struct timespec ts;
+    int rv;
+
+    pthread_mutex_lock(&metrics_lock);
+
+    while (!metrics_stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += METRICS_INTERVAL;
+
+        rv = pthread_cond_timedwait(&metrics_cond, &metrics_lock, &ts);
+
+        if (rv == ETIMEDOUT && !metrics_stop) {
+            pthread_mutex_unlock(&metrics_lock);
+            _metrics_maybe_flush();
+            pthread_mutex_lock(&metrics_lock);
+        }
+    }
+
+    pthread_mutex_unlock(&metrics_lock);
+
+    return NULL;
+}
+
+int metrics_flush (void) {
+    if (__atomic_load_n(&metrics_state, __ATOMIC_ACQUIRE) != 2) return -1;
+
+    __atomic_store_n(&metrics_shm->last_flush, (uint64_t) time(NULL),
+        __ATOMIC_RELAXED);
+
+    return _metrics_write();
+}
+
+/* Find or claim the slot of a labelled counter. */
+static struct metrics_label *_metrics_label (int id, const char *label) {
+    char buf[METRICS_LABEL_LEN];
+    int i, spin;
+
+    /* Keep label values safe to print unquoted in the exposition format. */
+    for (i = 0; label[i] && i < METRICS_LABEL_LEN - 1; i++) {
+        buf[i] = (isalnum((unsigned char) label[i]) || label[i] == '_' ||
+            label[i] == '-' || label[i] == '.') ? label[i] : '_';
+    }
+    buf[i] = '\0';
+
+    for (i = 0; i < METRICS_NLABELS; i++) {
+        struct metrics_label *l = &metrics_shm->label[i];
+        uint32_t state = __atomic_load_n(&l->state, __ATOMIC_ACQUIRE);
+
+        if (state == 0 && __atomic_compare_exchange_n(&l->state, &state, 1, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            l->id = id;
+            memcpy(l->label, buf, METRICS_LABEL_LEN);
+            __atomic_store_n(&l->state, 2, __ATOMIC_RELEASE);
+            return l;
+        }
+
+        /* Someone else is claiming this slot, it only takes a few stores. */
+        for (spin = 0; state == 1 && spin < 1000; spin++) {
+            state = __atomic_load_n(&l->state, __ATOMIC_ACQUIRE);
+        }
+
+        /* The slot may be getting this very label, claiming another one
+         * would export the series twice.  Drop the sample instead. */
+        if (state == 1) return NULL;
+
+        if (state == 2 && l->id == id &&
+            strncmp(l->label, buf, METRICS_LABEL_LEN) == 0) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+void metrics_add (int id, const char *label, uint64_t value) {
+    if (__atomic_load_n(&metrics_state, __ATOMIC_ACQUIRE) != 2) return;
+    if (id < 0 || id >= M_MAX) return;
+
+    if (label) {
+        struct metrics_label *l = _metrics_label(id, label);
+
+        if (l) __atomic_fetch_add(&l->value, value, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&metrics_shm->counter[id], value, __ATOMIC_RELAXED);
+    }
+
+    if (!__atomic_load_n(&metrics_dirty, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&metrics_dirty, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_observe (int id, double value) {
+    const struct metrics_def *d;
+    struct metrics_hist *h;
+    int i;
+
+    if (__atomic_load_n(&metrics_state, __ATOMIC_ACQUIRE) != 2) return;
+    if (id < 0 || id >= M_MAX || metrics_defs[id].buckets == NULL) return;
+
+    d = &metrics_defs[id];
+    h = &metrics_shm->hist[id];
+
+    for (i = 0; i < d->nbuckets && value > d->buckets[i]; i++);
+
+    __atomic_fetch_add(&h->bucket[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, (uint64_t) (value * 1e6), __ATOMIC_RELAXED);
+
+    if (!__atomic_load_n(&metrics_dirty, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&metrics_dirty, 1, __ATOMIC_RELAXED);
+    }
+}
+
+double metrics_now (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void metrics_fini (void) {
+    if (__atomic_load_n(&metrics_state, __ATOMIC_ACQUIRE) != 2) return;
+
+    /* The thread has to be gone before the plugin is unloaded. */
+    if (metrics_pid == getpid()) {
+        pthread_mutex_lock(&metrics_lock);
+        metrics_stop = 1;
+        pthread_cond_signal(&metrics_cond);
+        pthread_mutex_unlock(&metrics_lock);
+        pthread_join(metrics_thread, NULL);
+    }
+
+    metrics_pid = 0;
+
+    /* slurmctld unloading the plugin writes what it has.  Every job step
+     * ends in here, so slurmstepd only writes once per METRICS_INTERVAL on
+     * the node, the updates of the other steps are in the state file until
+     * then. */
+    if (__atomic_load_n(&metrics_dirty, __ATOMIC_RELAXED)) {
+        if (metrics_side == METRICS_SLURMCTLD) {
+            metrics_flush();
+        } else {
+            _metrics_maybe_flush();
+        }
+    }
+
+    /* Start over if the plugin is initialized again. */
+    munmap(metrics_shm, sizeof(struct metrics_shm));
+    metrics_shm = NULL;
+    metrics_dirty = 0;
+    __atomic_store_n(&metrics_state, 0, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * metrics.h: Prometheus counters and histograms shared by all plugins.
+ *
+ * Metrics are kept in a small mmap'd state file per side (slurmctld or
+ * slurmstepd) so that the plugins loaded in different processes on the same
+ * node add up to one set of series.  Updates are atomic adds, no locks, and
+ * never write the textfile themselves.  In slurmctld a background thread
+ * started by metrics_init() writes the series to the node_exporter textfile
+ * collector directory every METRICS_INTERVAL seconds, and metrics_fini()
+ * writes them once more if the process updated any.  slurmstepd has no
+ * thread, the step ending in metrics_fini() writes them if the last write is
+ * older than METRICS_INTERVAL, so a node writes at most once per interval.
+ *
+ * Both the state file and the textfile directory have to be writable by the
+ * daemon, e.g. by SlurmUser for slurmctld.  Otherwise metrics are silently
+ * disabled.
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+/* Location of the state files, "%s" is the side name. */
+#ifndef METRICS_STATE_PATH
+#define METRICS_STATE_PATH "/run/slurm_plugins_%s.metrics"
+#endif
+
+/* node_exporter --collector.textfile.directory, "%s" is the side name. */
+#ifndef METRICS_TEXTFILE_PATH
+#define METRICS_TEXTFILE_PATH \
+    "/var/lib/node_exporter/textfile_collector/slurm_plugins_%s.prom"
+#endif
+
+/* Minimum number of seconds between two textfile flushes. */
+#ifndef METRICS_INTERVAL
+#define METRICS_INTERVAL 60
+#endif
+
+#define METRICS_MAGIC 0x4d4c5053  /* "SPLM" */
+#define METRICS_VERSION 1
+#define METRICS_NBUCKETS 12     /* Histogram buckets, +Inf excluded. */
+#define METRICS_NLABELS 64      /* Labelled counter slots. */
+#define METRICS_LABEL_LEN 32
+
+/* Daemon the plugin is loaded into, each one has its own files. */
+enum metrics_side {
+    METRICS_SLURMCTLD = 0,
+    METRICS_SLURMSTEPD,
+    METRICS_SIDE_MAX
+};
+
+/* All metrics known to the plugins. */
+enum metrics_id {
+    M_RATIO_REJECTED = 0,       /* counter, label "partition" */
+    M_SCRIPTS_COLLECTED,        /* counter */
+    M_SCRIPT_BYTES,             /* counter */
+    M_SCRIPT_WRITE_SECONDS,     /* histogram */
+    M_TMP_CLEANUP_SECONDS,      /* histogram */
+    M_TMP_FILES_REMOVED,        /* histogram, files per job */
+    M_MAX
+};
+
+/* Histogram state. */
+struct metrics_hist {
+    uint64_t bucket[METRICS_NBUCKETS + 1];  /* Not cumulative. */
+    uint64_t count;
+    uint64_t sum;           /* In millionths. */
+};
+
+/* Labelled counter slot. */
+struct metrics_label {
+    uint32_t state;         /* 0 = free, 1 = being claimed, 2 = in use. */
+    uint32_t id;
+    char label[METRICS_LABEL_LEN];
+    uint64_t value;
+};
+
+/* Layout of the state file. */
+struct metrics_shm {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t last_flush;
+    uint64_t counter[M_MAX];
+    struct metrics_hist hist[M_MAX];
+    struct metrics_label label[METRICS_NLABELS];
+};
+
+/* Map the state file of the given side, cheap to call repeatedly. */
+int metrics_init(int side);
+
+/* Add to a counter, label may be NULL for unlabelled counters. */
+void metrics_add(int id, const char *label, uint64_t value);
+
+/* Record an observation in a histogram. */
+void metrics_observe(int id, double value);
+
+/* Monotonic clock in seconds, for measuring latencies. */
+double metrics_now(void);
+
+/* Write the textfile now. */
+int metrics_flush(void);
+
+/* Stop the flusher thread and write the textfile if this process updated a
+ * metric (at most once per METRICS_INTERVAL in slurmstepd), call it from the
+ * plugin fini() or slurm_spank_exit(). */
+void metrics_fini(void);
+
+#endif /* _METRICS_H */
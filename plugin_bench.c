@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * plugin_bench.c: Test and benchmark driver for the plugins without a cluster.
+ *
+ * The plugin is dlopen()ed with stub implementations of the Slurm symbols it
+ * needs (see plugin_stubs.c) and one of its callbacks is driven with
+ * synthetic job descriptors or fake SPANK handles, across several threads and
+ * processes.  Throughput and latency percentiles of the callback are reported.
+ *
+ * With -r the job descriptors come from a submission trace generated by
+ * job_replay instead, and are submitted at the original inter-arrival times
+ * scaled by the -x speed factor, as the job user recorded in the trace (root
+ * if unknown).  How late the submissions start compared to the trace is
+ * reported as lag.
+ *
+ * The plugin does its real work: job scripts are written, directories are
+ * created and removed.  Point the plugin to scratch locations when needed.
+ *
+ * Like the job_submit plugins it needs the Slurm source tree to build:
+ *
+ * gcc -O2 -rdynamic -pthread -I${SLURM_SRC_DIR} -o plugin_bench plugin_bench.c
+ *     plugin_stubs.c replay_trace.c -ldl
+ *
+ * Usage: plugin_bench -p plugin.so [-m mode] [-n iterations] [-t threads]
+ *                     [-P processes] [-s script_size] [-j first_jobid]
+ *                     [-r trace [-x speed]] [-a plugin_arg]... [-v]
+ *
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "src/slurmctld/slurmctld.h"
+
+#include "plugin_stubs.h"
+#include "replay_trace.h"
+
+
+/* Everything but main() is static: -rdynamic exports the executable's
+ * symbols, which would otherwise interpose the plugin's own (myname, ...). */
+static const char *myname = "plugin_bench";
+
+/* Callbacks that can be driven. */
+enum bench_mode {
+    MODE_SUBMIT,
+    MODE_MODIFY,
+    MODE_INIT,
+    MODE_PROLOG,
+    MODE_EPILOG,
+    MODE_JOB,
+    MODE_TASK,
+};
+
+static const char *mode_names[] = {
+    "submit", "modify", "init", "prolog", "epilog", "job", "task", NULL
+};
+
+/* Signatures of the plugin entry points. */
+typedef int (*job_submit_f)(struct job_descriptor *, uint32_t, char **);
+typedef int (*job_modify_f)(struct job_descriptor *, struct job_record *,
+    uint32_t);
+typedef int (*spank_cb_f)(struct spank_handle *, int, char **);
+
+/* Results shared by all worker processes. */
+struct bench_shared {
+    uint64_t nfail;
+    uint64_t max_lag;   /* Replay only, in nanoseconds. */
+    uint64_t sum_lag;
+    uint64_t lat[];     /* Latency of every call in nanoseconds. */
+};
+
+/* Benchmark settings. */
+static int mode = MODE_SUBMIT;
+static long niter = 10000;
+static int nthread = 1;
+static int nproc = 1;
+static long script_size = 1024;
+static uint32_t first_jobid = 1000000;
+static int plugin_ac = 0;
+static char *plugin_av[64];
+
+/* Resolved plugin entry points. */
+static job_submit_f job_submit_cb = NULL;
+static job_modify_f job_modify_cb = NULL;
+static spank_cb_f spank_cb[2] = {NULL, NULL};
+
+/* Synthetic job script. */
+static char *script = NULL;
+
+/* Replayed submission trace. */
+static struct replay_job *jobs = NULL;
+static long njobs = 0;
+static double speed = 1.0;
+static uint64_t replay_t0 = 0;
+
+static struct bench_shared *shared = NULL;
+
+/* Synthetic partitions and GRES, NULL means not requested. */
+static const char *partitions[] = {"gpu", "gpu2", "lr3", "lr4", NULL};
+static const char *gres[] = {"gpu:1", "gpu:2", "gpu:4", "gpu:tesla:2", NULL};
+
+
+/* Print usage. */
+static void _usage (void) {
+    fprintf(stderr,
+        "Usage: %s -p plugin.so [-m mode] [-n iterations] [-t threads]\n"
+        "          [-P processes] [-s script_size] [-j first_jobid]\n"
+        "          [-r trace [-x speed]] [-a plugin_arg]... [-v]\n"
+        "\n"
+        "Modes:\n"
+        "  submit  job_submit() with synthetic job descriptors (default)\n"
+        "  modify  job_modify() with synthetic job descriptors and records\n"
+        "  init    slurm_spank_init() in remote context\n"
+        "  prolog  slurm_spank_job_prolog()\n"
+        "  epilog  slurm_spank_job_epilog()\n"
+        "  job     slurm_spank_job_prolog() + slurm_spank_job_epilog()\n"
+        "  task    slurm_spank_task_init_privileged() in a forked child per\n"
+        "          call, needs root and changes the propagation of '/' just\n"
+        "          like slurmstepd does\n"
+        "\n"
+        "  -r replays a job_replay trace through job_submit() instead of\n"
+        "  synthetic jobs, -x scales its speed (0 = as fast as possible)\n",
+        myname);
+}
+
+/* Monotonic clock in nanoseconds. */
+static uint64_t _now (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64, good enough to mix the synthetic jobs. */
+static uint64_t _rand (uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+
+    return *s;
+}
+
+/* Build a job script of roughly the requested size. */
+static char *_make_script (long size) {
+    const char *head = "#!/bin/bash\n#SBATCH --job-name=bench\n";
+    const char *line = "srun ./a.out input.dat > output.dat\n";
+    long len = strlen(head), n = strlen(line);
+    char *s;
+
+    s = malloc(size + len + n + 1);
+
+    if (s == NULL) return NULL;
+
+    strcpy(s, head);
+
+    while (len < size) {
+        memcpy(s + len, line, n);
+        len += n;
+    }
+
+    s[len] = '\0';
+
+    return s;
+}
+
+/* Run one callback, return its return code. */
+static int _call (long worker, long i, uint64_t *rng) {
+    uint32_t jobid = first_jobid + worker * niter + i;
+    struct job_descriptor desc;
+    struct job_record rec;
+    struct spank_handle sh;
+    char *err_msg = NULL;
+    int rv;
+
+    switch (mode) {
+    case MODE_SUBMIT:
+    case MODE_MODIFY:
+        memset(&desc, 0, sizeof(desc));
+        desc.job_id = jobid;
+        desc.user_id = 1000 + _rand(rng) % 100;
+        desc.partition = (char *) partitions[_rand(rng) % 5];
+        desc.gres = (char *) gres[_rand(rng) % 5];
+        desc.min_cpus = 1 + _rand(rng) % 32;
+        desc.script = script;
+        desc.work_dir = "/home/bench";
+
+        if (mode == MODE_SUBMIT) {
+            rv = job_submit_cb(&desc, desc.user_id, &err_msg);
+            free(desc.admin_comment);
+            free(err_msg);
+            return rv;
+        }
+
+        /* Modify some fields, keep the rest from the job record. */
+        memset(&rec, 0, sizeof(rec));
+        rec.partition = (char *) partitions[_rand(rng) % 5];
+        rec.gres = (char *) gres[_rand(rng) % 5];
+        rec.total_cpus = 1 + _rand(rng) % 32;
+
+        if (_rand(rng) % 2) desc.partition = NULL;
+        if (_rand(rng) % 2) desc.gres = NULL;
+        if (_rand(rng) % 2) desc.min_cpus = (uint32_t) -2;
+
+        return job_modify_cb(&desc, &rec, desc.user_id);
+    default:
+        sh.jobid = jobid;
+        sh.stepid = 0;
+        sh.uid = getuid();
+        sh.gid = getgid();
+        sh.remote = 1;
+
+        rv = spank_cb[0](&sh, plugin_ac, plugin_av);
+
+        if (rv == 0 && spank_cb[1]) {
+            rv = spank_cb[1](&sh, plugin_ac, plugin_av);
+        }
+
+        return rv;
+    }
+}
+
+/* Submit the trace jobs assigned to a worker, at their trace times. */
+static void _replay (long worker) {
+    long nworker = (long) nthread * nproc;
+    long i;
+
+    for (i = worker; i < njobs; i += nworker) {
+        struct replay_job *j = &jobs[i];
+        struct job_descriptor desc;
+        struct timespec ts;
+        char *err_msg = NULL;
+        char *buf;
+        uint64_t due, t0, lag, old;
+        uint32_t uid;
+        int rv;
+
+        /* Submit as the job user, so that per user policies see the real
+         * traffic.  Jobs of unknown users are submitted as root. */
+        uid = j->uid == REPLAY_NO_UID ? 0 : j->uid;
+
+        /* Read the script ahead of time, it is not part of the latency.  A job
+         * without one in the trace is submitted like srun's, one whose script
+         * is gone with an empty script to keep the arrival pattern. */
+        buf = NULL;
+
+        if (j->script && (buf = replay_read_file(j->script, NULL)) == NULL) {
+            fprintf(stderr, "%s: Unable to read %s: %m\n", myname, j->script);
+            buf = strdup("");
+        }
+
+        due = replay_t0 + (speed > 0 ? j->offset_us * 1000 / speed : 0);
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+        memset(&desc, 0, sizeof(desc));
+        desc.job_id = j->jobid;
+        desc.user_id = uid;
+        desc.partition = j->partition;
+        desc.gres = j->gres;
+        desc.min_cpus = j->min_cpus;
+        desc.script = buf;
+        desc.work_dir = j->workdir ? j->workdir : "/";
+
+        t0 = _now();
+        rv = job_submit_cb(&desc, uid, &err_msg);
+        shared->lat[i] = _now() - t0;
+
+        lag = t0 > due ? t0 - due : 0;
+        __atomic_fetch_add(&shared->sum_lag, lag, __ATOMIC_RELAXED);
+
+        /* Workers of all processes race for the maximum. */
+        old = __atomic_load_n(&shared->max_lag, __ATOMIC_RELAXED);
+        while (lag > old && !__atomic_compare_exchange_n(&shared->max_lag,
+            &old, lag, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        if (rv) __atomic_fetch_add(&shared->nfail, 1, __ATOMIC_RELAXED);
+
+        free(desc.admin_comment);
+        free(err_msg);
+        free(buf);
+    }
+}
+
+/* Worker thread, runs niter calls and records their latencies. */
+static void *_worker (void *arg) {
+    long worker = (long) arg;
+    uint64_t rng = 0x9e3779b97f4a7c15ULL ^ (worker + 1);
+    uint64_t *lat = shared->lat + worker * niter;
+    long i;
+
+    if (jobs) {
+        _replay(worker);
+        return NULL;
+    }
+
+    stubs_set_slurmd(mode == MODE_PROLOG || mode == MODE_EPILOG ||
+        mode == MODE_JOB);
+
+    for (i = 0; i < niter; i++) {
+        uint64_t t0 = _now();
+        int rv;
+
+        if (mode == MODE_TASK) {
+            /* unshare() needs a single threaded process, like a task. */
+            pid_t pid = fork();
+            int status;
+
+            if (pid == 0) {
+                _exit(_call(worker, i, &rng) ? 1 : 0);
+            }
+
+            rv = (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status));
+        } else {
+            rv = _call(worker, i, &rng);
+        }
+
+        lat[i] = _now() - t0;
+
+        if (rv) __atomic_fetch_add(&shared->nfail, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/* Worker process, runs nthread threads. */
+static int _process (int proc) {
+    pthread_t tid[nthread];
+    long t;
+
+    for (t = 0; t < nthread; t++) {
+        if (pthread_create(&tid[t], NULL, _worker,
+            (void *) (proc * nthread + t))) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (t = 0; t < nthread; t++) {
+        pthread_join(tid[t], NULL);
+    }
+
+    return 0;
+}
+
+/* qsort comparator. */
+static int _cmp (const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Latency at the given percentile, in microseconds. */
+static double _pct (uint64_t *lat, long n, double p) {
+    long i = (long) (p / 100.0 * (n - 1) + 0.5);
+
+    return lat[i] / 1e3;
+}
+
+int main (int argc, char **argv) {
+    const char *plugin = NULL;
+    const char *trace = NULL;
+    const char *plugin_type;
+    int (*init_cb)(void);
+    void (*fini_cb)(void);
+    uint64_t t0, wall;
+    long ncall;
+    size_t size;
+    void *dl;
+    int opt, p;
+
+    while ((opt = getopt(argc, argv, "p:m:n:t:P:s:j:r:x:a:vh")) != -1) {
+        switch (opt) {
+        case 'p':
+            plugin = optarg;
+            break;
+        case 'm':
+            for (mode = 0; mode_names[mode]; mode++) {
+                if (strcmp(optarg, mode_names[mode]) == 0) break;
+            }
+            if (mode_names[mode] == NULL) {
+                fprintf(stderr, "%s: Unknown mode %s\n", myname, optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            niter = strtol(optarg, NULL, 10);
+            break;
+        case 't':
+            nthread = strtol(optarg, NULL, 10);
+            break;
+        case 'P':
+            nproc = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            script_size = strtol(optarg, NULL, 10);
+            break;
+        case 'j':
+            first_jobid = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            trace = optarg;
+            break;
+        case 'x':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'a':
+            if (plugin_ac == 64) {
+                fprintf(stderr, "%s: Too many plugin arguments\n", myname);
+                return 1;
+            }
+            plugin_av[plugin_ac++] = optarg;
+            break;
+        case 'v':
+            stubs_verbose = 1;
+            break;
+        default:
+            _usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (plugin == NULL || niter < 1 || nthread < 1 || nproc < 1 ||
+        (trace && mode != MODE_SUBMIT)) {
+        _usage();
+        return 1;
+    }
+
+    if (trace) {
+        njobs = replay_load(trace, &jobs);
+
+        if (njobs < 1) {
+            fprintf(stderr, "%s: Unable to load jobs from %s\n", myname,
+                trace);
+            return 1;
+        }
+    }
+
+    /* A plain file name would be searched in the library path. */
+    if (strchr(plugin, '/') == NULL) {
+        static char path[PATH_MAX];
+
+        snprintf(path, PATH_MAX, "./%s", plugin);
+        plugin = path;
+    }
+
+    dl = dlopen(plugin, RTLD_NOW | RTLD_LOCAL);
+
+    if (dl == NULL) {
+        fprintf(stderr, "%s: Unable to load %s: %s\n", myname, plugin,
+            dlerror());
+        return 1;
+    }
+
+    switch (mode) {
+    case MODE_SUBMIT:
+        job_submit_cb = (job_submit_f) dlsym(dl, "job_submit");
+        break;
+    case MODE_MODIFY:
+        job_modify_cb = (job_modify_f) dlsym(dl, "job_modify");
+        break;
+    case MODE_INIT:
+        spank_cb[0] = (spank_cb_f) dlsym(dl, "slurm_spank_init");
+        break;
+    case MODE_PROLOG:
+        spank_cb[0] = (spank_cb_f) dlsym(dl, "slurm_spank_job_prolog");
+        break;
+    case MODE_EPILOG:
+        spank_cb[0] = (spank_cb_f) dlsym(dl, "slurm_spank_job_epilog");
+        break;
+    case MODE_JOB:
+        spank_cb[0] = (spank_cb_f) dlsym(dl, "slurm_spank_job_prolog");
+        spank_cb[1] = (spank_cb_f) dlsym(dl, "slurm_spank_job_epilog");
+        break;
+    case MODE_TASK:
+        spank_cb[0] = (spank_cb_f) dlsym(dl,
+            "slurm_spank_task_init_privileged");
+        break;
+    }
+
+    if (job_submit_cb == NULL && job_modify_cb == NULL &&
+        (spank_cb[0] == NULL || (mode == MODE_JOB && spank_cb[1] == NULL))) {
+        fprintf(stderr, "%s: %s has no callback for mode %s\n", myname,
+            plugin, mode_names[mode]);
+        return 1;
+    }
+
+    script = _make_script(script_size);
+
+    /* Shared with the worker processes. */
+    ncall = jobs ? njobs : niter * nthread * nproc;
+    size = sizeof(struct bench_shared) + ncall * sizeof(uint64_t);
+    shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (script == NULL || shared == MAP_FAILED) {
+        perror(myname);
+        return 1;
+    }
+
+    /* job_submit plugins may have init()/fini(), called once by slurmctld. */
+    init_cb = (int (*)(void)) dlsym(dl, "init");
+    fini_cb = (void (*)(void)) dlsym(dl, "fini");
+
+    if (init_cb && init_cb()) {
+        fprintf(stderr, "%s: init() of %s failed\n", myname, plugin);
+        return 1;
+    }
+
+    t0 = _now();
+    replay_t0 = t0;
+
+    if (nproc == 1) {
+        _process(0);
+    } else {
+        for (p = 0; p < nproc; p++) {
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+
+            if (pid == 0) {
+                _exit(_process(p));
+            }
+        }
+
+        while (wait(NULL) > 0);
+    }
+
+    wall = _now() - t0;
+
+    if (fini_cb) fini_cb();
+
+    qsort(shared->lat, ncall, sizeof(uint64_t), _cmp);
+
+    plugin_type = dlsym(dl, "plugin_type");
+
+    printf("plugin:     %s (%s)\n", plugin,
+        plugin_type ? plugin_type : "unknown");
+    if (jobs) {
+        printf("mode:       %s, %d process(es) x %d thread(s), replay of %s "
+            "at %gx\n", mode_names[mode], nproc, nthread, trace, speed);
+    } else {
+        printf("mode:       %s, %d process(es) x %d thread(s) x %ld call(s)\n",
+            mode_names[mode], nproc, nthread, niter);
+    }
+    printf("calls:      %ld, failed: %llu\n", ncall,
+        (unsigned long long) shared->nfail);
+    printf("wall:       %.3f s, throughput: %.1f calls/s\n", wall / 1e9,
+        ncall / (wall / 1e9));
+    printf("latency us: min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+        "p99.9 %.1f, max %.1f\n",
+        _pct(shared->lat, ncall, 0), _pct(shared->lat, ncall, 50),
+        _pct(shared->lat, ncall, 90), _pct(shared->lat, ncall, 99),
+        _pct(shared->lat, ncall, 99.9), _pct(shared->lat, ncall, 100));
+
+    if (jobs) {
+        printf("lag ms:     avg %.3f, max %.3f\n",
+            shared->sum_lag / 1e6 / ncall, shared->max_lag / 1e6);
+    }
+
+    return 0;
+}
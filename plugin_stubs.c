@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * plugin_stubs.c: Stub implementations of the Slurm symbols used by the
+ * plugins, see plugin_stubs.h.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <slurm/spank.h>
+
+#include "plugin_stubs.h"
+
+
+int stubs_verbose = 0;
+uint64_t stubs_nerrors = 0;
+
+static __thread int stubs_context = S_CTX_REMOTE;
+
+
+void stubs_set_slurmd (int slurmd) {
+    stubs_context = slurmd ? S_CTX_SLURMD : S_CTX_REMOTE;
+}
+
+/* Common log function. */
+static void _stubs_log (const char *level, const char *fmt, va_list ap) {
+    if (!stubs_verbose) return;
+
+    fprintf(stderr, "%s: ", level);
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+}
+
+/* slurmctld logging, used by job_submit plugins. */
+void info (const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    _stubs_log("info", fmt, ap);
+    va_end(ap);
+}
+
+/* xstrcat(), appends to a string in place, plain malloc() instead of
+ * xmalloc(), the driver releases job descriptor strings with free(). */
+void _xstrcat (char **str1, const char *str2) {
+    size_t len1 = *str1 ? strlen(*str1) : 0;
+    size_t len2 = str2 ? strlen(str2) : 0;
+    char *s;
+
+    s = realloc(*str1, len1 + len2 + 1);
+
+    if (s == NULL) return;
+
+    memcpy(s + len1, str2 ? str2 : "", len2 + 1);
+    *str1 = s;
+}
+
+/* xstrdup_printf(), used for job_submit() error messages. */
+char *xstrdup_printf (const char *fmt, ...) {
+    va_list ap;
+    char *s;
+
+    va_start(ap, fmt);
+    if (vasprintf(&s, fmt, ap) < 0) s = NULL;
+    va_end(ap);
+
+    return s;
+}
+
+/* SPANK logging. */
+void slurm_info (const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    _stubs_log("info", fmt, ap);
+    va_end(ap);
+}
+
+void slurm_error (const char *fmt, ...) {
+    va_list ap;
+
+    __atomic_fetch_add(&stubs_nerrors, 1, __ATOMIC_RELAXED);
+
+    va_start(ap, fmt);
+    _stubs_log("error", fmt, ap);
+    va_end(ap);
+}
+
+/* SPANK API. */
+int spank_remote (spank_t sp) {
+    return sp->remote;
+}
+
+spank_context_t spank_context (void) {
+    return stubs_context;
+}
+
+spank_err_t spank_get_item (spank_t sp, spank_item_t item, ...) {
+    spank_err_t rv = ESPANK_SUCCESS;
+    va_list ap;
+
+    va_start(ap, item);
+
+    switch (item) {
+    case S_JOB_UID:
+        *va_arg(ap, uid_t *) = sp->uid;
+        break;
+    case S_JOB_GID:
+        *va_arg(ap, gid_t *) = sp->gid;
+        break;
+    case S_JOB_ID:
+        *va_arg(ap, uint32_t *) = sp->jobid;
+        break;
+    case S_JOB_STEPID:
+        *va_arg(ap, uint32_t *) = sp->stepid;
+        break;
+    default:
+        rv = ESPANK_BAD_ARG;
+    }
+
+    va_end(ap);
+
+    return rv;
+}
+
+/* Job options come from $SPANK_OPTION_<name>, e.g. SPANK_OPTION_scratch=10g,
+ * unset means the option was not given. */
+spank_err_t spank_option_getopt (spank_t sp, struct spank_option *opt,
+        char **optarg) {
+    char name[256];
+    char *value;
+
+    snprintf(name, sizeof(name), "SPANK_OPTION_%s", opt->name);
+    value = getenv(name);
+
+    if (value == NULL) return ESPANK_ERROR;
+
+    if (optarg) *optarg = value;
+
+    return ESPANK_SUCCESS;
+}
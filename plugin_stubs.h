@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * plugin_stubs.h: Stub implementations of the Slurm symbols used by the
+ * plugins, so they can be dlopen()ed outside of slurmctld and slurmstepd.
+ *
+ * Link the driver with -rdynamic to make the stubs visible to the plugins.
+ *
+ */
+
+#ifndef _PLUGIN_STUBS_H
+#define _PLUGIN_STUBS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Fake SPANK handle, a spank_t points to one of these. */
+struct spank_handle {
+    uint32_t jobid;
+    uint32_t stepid;
+    uid_t uid;
+    gid_t gid;
+    int remote;
+};
+
+/* Print plugin log messages to stderr. */
+extern int stubs_verbose;
+
+/* Number of slurm_error() calls so far. */
+extern uint64_t stubs_nerrors;
+
+/* Make spank_context() return S_CTX_SLURMD (job prolog and epilog) instead
+ * of S_CTX_REMOTE in the calling thread. */
+void stubs_set_slurmd(int slurmd);
+
+#endif /* _PLUGIN_STUBS_H */
@@ -0,0 +1,539 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * ratio_sim.c: Offline policy simulator for job_submit_require_cpu_gpu_ratio.
+ *
+ * Evaluate the "mypart"/"ratio" rules of a job_submit_require_cpu_gpu_ratio.so
+ * build against historical jobs before deploying it.  The plugin is
+ * dlopen()ed with stubbed Slurm symbols (see plugin_stubs.c) and its own rule
+ * evaluation is run on every record, in parallel on all cores.  Rejections
+ * are reported per rule, partition and user.
+ *
+ * Records are read either from an sacct dump, e.g.
+ *
+ *   sacct -a -X -P -S 2017-01-01 -E 2017-06-30 \
+ *       --format=JobID,User,Partition,ReqCPUS,ReqTRES > jobs.txt
+ *
+ * (ReqGRES/AllocTRES and NCPUS/AllocCPUS columns are understood as well), or
+ * from a job_replay trace built from collected job scripts.
+ *
+ * gcc -O2 -rdynamic -pthread -o ratio_sim ratio_sim.c plugin_stubs.c -ldl
+ *
+ * Usage: ratio_sim -p job_submit_require_cpu_gpu_ratio.so -f records
+ *                  [-t threads] [-u top_users]
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "plugin_stubs.h"
+
+
+/* Everything but main() is static: -rdynamic exports the executable's
+ * symbols, which would otherwise interpose the plugin's own (myname, ...). */
+static const char *myname = "ratio_sim";
+
+/* Same order as enum ratio_verdict in job_submit_require_cpu_gpu_ratio.c. */
+static const char *verdict_names[] = {
+    "ok", "missing GRES", "no GPU in GRES", "invalid GPU number",
+    "too few CPUs per GPU", "regex error"
+};
+#define NVERDICT 6
+
+typedef int (*verdict_f)(char *, char *, uint32_t, int *, uint32_t *);
+
+/* Rules of the loaded plugin. */
+static verdict_f verdict = NULL;
+static const int *npart = NULL;
+static const char **mypart = NULL;
+static const int *ratio = NULL;
+
+/* Record layout. */
+enum { FMT_SACCT, FMT_TRACE };
+static int fmt = FMT_TRACE;
+static int col_jobid = -1, col_user = -1, col_part = -1, col_cpus = -1, col_gres = -1;
+static int gres_is_tres = 0;
+
+/* Rejection tally keyed by a string. */
+struct tally {
+    char *key;
+    uint64_t jobs;
+    uint64_t rejected;
+};
+
+struct table {
+    struct tally *t;
+    size_t cap;
+    size_t n;
+};
+
+/* Per thread work and results. */
+struct worker {
+    pthread_t tid;
+    const char *start;
+    const char *end;
+    uint64_t nrec;
+    uint64_t nrej;
+    struct table part;
+    struct table user;
+    struct table rule;
+};
+
+
+/* Print usage. */
+static void _usage (void) {
+    fprintf(stderr, "Usage: %s -p job_submit_require_cpu_gpu_ratio.so "
+        "-f records [-t threads] [-u top_users]\n", myname);
+}
+
+/* FNV-1a. */
+static uint64_t _hash (const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+/* Add to the tally of a key, open addressing with linear probing. */
+static void _tally (struct table *tb, const char *key, uint64_t jobs,
+        uint64_t rejected) {
+    size_t i;
+
+    if (tb->n * 2 >= tb->cap) {
+        struct table old = *tb;
+
+        tb->cap = tb->cap ? tb->cap * 2 : 256;
+        tb->t = calloc(tb->cap, sizeof(struct tally));
+        tb->n = 0;
+
+        if (tb->t == NULL) {
+            perror(myname);
+            exit(1);
+        }
+
+        for (i = 0; i < old.cap; i++) {
+            if (old.t[i].key) {
+                _tally(tb, old.t[i].key, old.t[i].jobs, old.t[i].rejected);
+                free(old.t[i].key);
+            }
+        }
+
+        free(old.t);
+    }
+
+    for (i = _hash(key) & (tb->cap - 1); tb->t[i].key;
+         i = (i + 1) & (tb->cap - 1)) {
+        if (strcmp(tb->t[i].key, key) == 0) break;
+    }
+
+    if (tb->t[i].key == NULL) {
+        tb->t[i].key = strdup(key);
+        tb->n++;
+    }
+
+    tb->t[i].jobs += jobs;
+    tb->t[i].rejected += rejected;
+}
+
+/* Split a line on a separator in place, returns the number of fields. */
+static int _split (char *line, char sep, char **f, int max) {
+    int n = 0;
+
+    f[n++] = line;
+
+    while (*line && n < max) {
+        if (*line == sep) {
+            *line = '\0';
+            f[n++] = line + 1;
+        }
+        line++;
+    }
+
+    return n;
+}
+
+/* Convert a TRES string ("cpu=4,gres/gpu:k80=2,...") to the GRES form the
+ * plugin sees ("gpu:k80:2"), NULL if no GPU is requested. */
+static char *_tres2gres (const char *tres, char *buf, size_t len) {
+    const char *p = strstr(tres, "gres/gpu");
+    const char *eq;
+
+    if (p == NULL) return NULL;
+
+    p += 5;
+    eq = strchr(p, '=');
+
+    if (eq == NULL) return NULL;
+
+    snprintf(buf, len, "%.*s:%.*s", (int) (eq - p), p,
+        (int) strcspn(eq + 1, ","), eq + 1);
+
+    return buf;
+}
+
+/* Evaluate one record. */
+static void _record (struct worker *w, char *line) {
+    char *f[64];
+    char gbuf[256];
+    char key[512];
+    char *user, *part, *gres;
+    uint32_t ncpu, ngpu;
+    int n, rule, v;
+
+    if (fmt == FMT_SACCT) {
+        n = _split(line, '|', f, 64);
+
+        if (col_user >= n || col_part >= n || col_cpus >= n || col_gres >= n)
+            return;
+
+        /* Job steps, in case the dump was made without -X. */
+        if (col_jobid >= 0 && col_jobid < n && strchr(f[col_jobid], '.'))
+            return;
+
+        user = col_user >= 0 ? f[col_user] : "-";
+        part = f[col_part];
+        ncpu = strtoul(f[col_cpus], NULL, 10);
+        gres = f[col_gres];
+
+        if (gres_is_tres) {
+            gres = _tres2gres(gres, gbuf, sizeof(gbuf));
+        } else if (*gres == '\0' || strcmp(gres, "(null)") == 0) {
+            gres = NULL;
+        }
+    } else {
+        if (line[0] == '#' || (n = _split(line, '\t', f, 8)) < 7) return;
+
+        user = n > 7 ? f[7] : "-";
+        part = f[2];
+        ncpu = strtoul(f[3], NULL, 10);
+        gres = strcmp(f[4], "-") == 0 ? NULL : f[4];
+    }
+
+    if (*part == '\0' || strcmp(part, "-") == 0) part = NULL;
+
+    v = verdict(part, gres, ncpu, &rule, &ngpu);
+
+    w->nrec++;
+    _tally(&w->part, part ? part : "-", 1, v != 0);
+    _tally(&w->user, user, 1, v != 0);
+
+    if (v != 0) {
+        w->nrej++;
+        snprintf(key, sizeof(key), "%s\t%d\t%s",
+            rule >= 0 ? mypart[rule] : "-", rule >= 0 ? ratio[rule] : 0,
+            v < NVERDICT ? verdict_names[v] : "unknown");
+        _tally(&w->rule, key, 1, 1);
+    }
+}
+
+/* Worker thread, evaluates the records in [start, end). */
+static void *_worker (void *arg) {
+    struct worker *w = arg;
+    const char *p = w->start;
+    char line[8192];
+
+    while (p < w->end) {
+        const char *nl = memchr(p, '\n', w->end - p);
+        size_t len = (nl ? nl : w->end) - p;
+
+        if (len < sizeof(line)) {
+            memcpy(line, p, len);
+            line[len] = '\0';
+            if (len && line[len - 1] == '\r') line[len - 1] = '\0';
+            if (line[0]) _record(w, line);
+        }
+
+        p += len + 1;
+    }
+
+    return NULL;
+}
+
+/* Find the columns in an sacct header of len bytes, no newline. */
+static int _header (const char *hdr, size_t len) {
+    char buf[8192];
+    char *f[64];
+    int i, n;
+
+    if (len > 0 && hdr[len - 1] == '\r') len--;
+    if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+
+    memcpy(buf, hdr, len);
+    buf[len] = '\0';
+    n = _split(buf, '|', f, 64);
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(f[i], "JobID")) col_jobid = i;
+        else if (!strcmp(f[i], "User")) col_user = i;
+        else if (!strcmp(f[i], "Partition")) col_part = i;
+        else if (!strcmp(f[i], "ReqCPUS") || !strcmp(f[i], "NCPUS") ||
+            !strcmp(f[i], "AllocCPUS")) col_cpus = i;
+        else if (!strcmp(f[i], "ReqGRES") || !strcmp(f[i], "AllocGRES"))
+            col_gres = i, gres_is_tres = 0;
+        else if (!strcmp(f[i], "ReqTRES") || !strcmp(f[i], "AllocTRES"))
+            col_gres = i, gres_is_tres = 1;
+    }
+
+    if (col_part < 0 || col_cpus < 0 || col_gres < 0) {
+        fprintf(stderr, "%s: sacct dump needs Partition, ReqCPUS (or NCPUS, "
+            "AllocCPUS) and ReqTRES (or ReqGRES, AllocTRES, AllocGRES) "
+            "columns\n", myname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* qsort comparator, most rejections first. */
+static int _cmp (const void *a, const void *b) {
+    const struct tally *x = a, *y = b;
+
+    if (x->rejected != y->rejected) return x->rejected < y->rejected ? 1 : -1;
+    if (x->jobs != y->jobs) return x->jobs < y->jobs ? 1 : -1;
+
+    return strcmp(x->key, y->key);
+}
+
+/* Print a table sorted by rejections, at most max rows. */
+static void _print (const char *title, struct table *tb, long max, int rule) {
+    struct tally *t = malloc(tb->n * sizeof(struct tally) + 1);
+    size_t i, n = 0;
+
+    for (i = 0; i < tb->cap; i++) {
+        if (tb->t[i].key) t[n++] = tb->t[i];
+    }
+
+    qsort(t, n, sizeof(struct tally), _cmp);
+
+    printf("\n%s\n", title);
+
+    if (rule) {
+        printf("  %-16s %6s  %-22s %12s\n", "partition", "ratio", "reason",
+            "rejected");
+    } else {
+        printf("  %-22s %12s %12s %8s\n", "", "jobs", "rejected", "%");
+    }
+
+    for (i = 0; i < n && (max < 0 || i < max); i++) {
+        if (rule) {
+            char *f[3];
+            char buf[512];
+
+            snprintf(buf, sizeof(buf), "%s", t[i].key);
+            _split(buf, '\t', f, 3);
+            printf("  %-16s %6s  %-22s %12llu\n", f[0], f[1], f[2],
+                (unsigned long long) t[i].rejected);
+        } else {
+            printf("  %-22s %12llu %12llu %8.2f\n", t[i].key,
+                (unsigned long long) t[i].jobs,
+                (unsigned long long) t[i].rejected,
+                100.0 * t[i].rejected / t[i].jobs);
+        }
+    }
+
+    free(t);
+}
+
+int main (int argc, char **argv) {
+    const char *plugin = NULL, *path = NULL;
+    long nthread = sysconf(_SC_NPROCESSORS_ONLN);
+    long top = 20;
+    struct worker *w;
+    struct table part = {0}, user = {0}, rule = {0};
+    struct timespec t0, t1;
+    uint64_t nrec = 0, nrej = 0;
+    const char *data, *p;
+    struct stat st;
+    size_t i, j;
+    void *dl;
+    int (*init_cb)(void);
+    void (*fini_cb)(void);
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "p:f:t:u:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            plugin = optarg;
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 't':
+            nthread = strtol(optarg, NULL, 10);
+            break;
+        case 'u':
+            top = strtol(optarg, NULL, 10);
+            break;
+        default:
+            _usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (plugin == NULL || path == NULL || nthread < 1) {
+        _usage();
+        return 1;
+    }
+
+    /* A plain file name would be searched in the library path. */
+    if (strchr(plugin, '/') == NULL) {
+        static char buf[PATH_MAX];
+
+        snprintf(buf, PATH_MAX, "./%s", plugin);
+        plugin = buf;
+    }
+
+    dl = dlopen(plugin, RTLD_NOW | RTLD_LOCAL);
+
+    if (dl == NULL) {
+        fprintf(stderr, "%s: Unable to load %s: %s\n", myname, plugin,
+            dlerror());
+        return 1;
+    }
+
+    verdict = (verdict_f) dlsym(dl, "_ratio_verdict");
+    npart = dlsym(dl, "npart");
+    mypart = dlsym(dl, "mypart");
+    ratio = dlsym(dl, "ratio");
+
+    if (!verdict || !npart || !mypart || !ratio) {
+        fprintf(stderr, "%s: %s is not a job_submit_require_cpu_gpu_ratio "
+            "plugin\n", myname, plugin);
+        return 1;
+    }
+
+    /* The plugin compiles its GPU regex in init(), as loaded by slurmctld. */
+    init_cb = (int (*)(void)) dlsym(dl, "init");
+    fini_cb = (void (*)(void)) dlsym(dl, "fini");
+
+    if (init_cb && init_cb()) {
+        fprintf(stderr, "%s: init() of %s failed\n", myname, plugin);
+        return 1;
+    }
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "%s: Unable to open %s: %s\n", myname, path,
+            strerror(errno));
+        return 1;
+    }
+
+    if (st.st_size == 0) {
+        fprintf(stderr, "%s: %s is empty\n", myname, path);
+        return 1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "%s: Unable to mmap %s: %s\n", myname, path,
+            strerror(errno));
+        return 1;
+    }
+
+    madvise((void *) data, st.st_size, MADV_SEQUENTIAL);
+
+    /* An sacct -P dump starts with a '|' separated header.  The mapping is
+     * not NUL terminated. */
+    p = memchr(data, '\n', st.st_size);
+    p = p ? p : data + st.st_size;
+
+    if (memchr(data, '|', p - data) != NULL) {
+        fmt = FMT_SACCT;
+
+        if (_header(data, p - data)) return 1;
+
+        p = p < data + st.st_size ? p + 1 : p;
+    } else {
+        p = data;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /* Split the records into one chunk per thread, on line boundaries. */
+    w = calloc(nthread, sizeof(struct worker));
+
+    for (i = 0; i < nthread; i++) {
+        const char *end = data + st.st_size;
+
+        w[i].start = i ? w[i - 1].end : p;
+
+        if (i < nthread - 1) {
+            const char *nl;
+
+            end = p + (data + st.st_size - p) * (i + 1) / nthread;
+            if (end < w[i].start) end = w[i].start;
+            nl = memchr(end, '\n', data + st.st_size - end);
+            end = nl ? nl + 1 : data + st.st_size;
+        }
+
+        w[i].end = end;
+
+        if (pthread_create(&w[i].tid, NULL, _worker, &w[i])) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < nthread; i++) {
+        pthread_join(w[i].tid, NULL);
+
+        nrec += w[i].nrec;
+        nrej += w[i].nrej;
+
+        for (j = 0; j < w[i].part.cap; j++) {
+            struct tally *t = &w[i].part.t[j];
+            if (t->key) _tally(&part, t->key, t->jobs, t->rejected);
+        }
+        for (j = 0; j < w[i].user.cap; j++) {
+            struct tally *t = &w[i].user.t[j];
+            if (t->key) _tally(&user, t->key, t->jobs, t->rejected);
+        }
+        for (j = 0; j < w[i].rule.cap; j++) {
+            struct tally *t = &w[i].rule.t[j];
+            if (t->key) _tally(&rule, t->key, t->jobs, t->rejected);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("plugin:   %s\n", plugin);
+    printf("rules:   ");
+    for (i = 0; i < *npart; i++) {
+        printf(" %s=%d", mypart[i], ratio[i]);
+    }
+    printf("\n");
+    printf("records:  %llu, rejected: %llu (%.2f%%)\n",
+        (unsigned long long) nrec, (unsigned long long) nrej,
+        nrec ? 100.0 * nrej / nrec : 0);
+    printf("time:     %.3f s with %ld thread(s)\n",
+        (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, nthread);
+
+    _print("Rejections per rule:", &rule, -1, 1);
+    _print("Per partition:", &part, -1, 0);
+    _print("Per user:", &user, top, 0);
+
+    if (fini_cb) fini_cb();
+
+    return 0;
+}
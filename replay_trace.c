@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * replay_trace.c: Replayable submission traces, see replay_trace.h.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay_trace.h"
+
+
+/* "-" stands for a missing field. */
+static char *_field (char *s) {
+    return strcmp(s, "-") == 0 ? NULL : strdup(s);
+}
+
+/* A string field as written, a value that would break the line or its
+ * fields apart is written as missing. */
+static const char *_str (const char *s) {
+    return s == NULL || strpbrk(s, "\t\n\r") ? "-" : s;
+}
+
+/* Options replay_parse_script() looks at, all of which take a value. */
+static const char *replay_opts[] = {
+    "partition", "p", "gres", "ntasks", "n", "cpus-per-task", "c", "nodes",
+    "N", "ntasks-per-node", NULL
+};
+
+static int _takes_value (const char *name) {
+    int i;
+
+    for (i = 0; replay_opts[i]; i++) {
+        if (strcmp(name, replay_opts[i]) == 0) return 1;
+    }
+
+    return 0;
+}
+
+long replay_load (const char *path, struct replay_job **jobs) {
+    struct replay_job *j = NULL;
+    long n = 0, max = 0;
+    char *line = NULL;
+    size_t len = 0;
+    FILE *fd;
+
+    fd = fopen(path, "r");
+
+    if (fd == NULL) return -1;
+
+    while (getline(&line, &len, fd) != -1) {
+        char *f[8];
+        char *p = line;
+        int i;
+
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        line[strcspn(line, "\n")] = '\0';
+
+        for (i = 0; i < 8 && p; i++) {
+            f[i] = strsep(&p, "\t");
+        }
+
+        /* Skip malformed lines, the uid is optional. */
+        if (i < 7) continue;
+
+        if (n == max) {
+            struct replay_job *tmp;
+
+            max = max ? max * 2 : 1024;
+            tmp = realloc(j, max * sizeof(*j));
+
+            if (tmp == NULL) {
+                replay_free(j, n);
+                free(line);
+                fclose(fd);
+                return -1;
+            }
+
+            j = tmp;
+        }
+
+        j[n].offset_us = strtoull(f[0], NULL, 10);
+        j[n].jobid = strtoul(f[1], NULL, 10);
+        j[n].partition = _field(f[2]);
+        j[n].min_cpus = strtoul(f[3], NULL, 10);
+        j[n].gres = _field(f[4]);
+        j[n].script = _field(f[5]);
+        j[n].workdir = _field(f[6]);
+        j[n].uid = i < 8 || strcmp(f[7], "-") == 0 ? REPLAY_NO_UID :
+            strtoul(f[7], NULL, 10);
+        n++;
+    }
+
+    free(line);
+    fclose(fd);
+
+    *jobs = j;
+
+    return n;
+}
+
+void replay_free (struct replay_job *jobs, long njobs) {
+    long i;
+
+    for (i = 0; i < njobs; i++) {
+        free(jobs[i].partition);
+        free(jobs[i].gres);
+        free(jobs[i].script);
+        free(jobs[i].workdir);
+    }
+
+    free(jobs);
+}
+
+void replay_write (FILE *fd, const struct replay_job *job) {
+    fprintf(fd, "%llu\t%u\t%s\t%u\t%s\t%s\t%s\t",
+        (unsigned long long) job->offset_us, job->jobid,
+        _str(job->partition), job->min_cpus, _str(job->gres),
+        _str(job->script), _str(job->workdir));
+
+    if (job->uid == REPLAY_NO_UID) {
+        fprintf(fd, "-\n");
+    } else {
+        fprintf(fd, "%u\n", job->uid);
+    }
+}
+
+/* Replace a string field. */
+static void _set (char **field, const char *value) {
+    free(*field);
+    *field = strdup(value);
+}
+
+int replay_parse_script (const char *script, struct replay_job *job) {
+    uint32_t ntasks = 0, cpus = 1, nodes = 0, per_node = 0, n;
+    const char *p = script;
+    char buf[1024];
+
+    while (*p) {
+        const char *end = strchr(p, '\n');
+        size_t len = end ? end - p : strlen(p);
+        char *tok, *save = NULL;
+        char *s = buf;
+
+        if (len > sizeof(buf) - 1) len = sizeof(buf) - 1;
+        memcpy(buf, p, len);
+        buf[len] = '\0';
+        p = end ? end + 1 : p + len;
+
+        while (isspace((unsigned char) *s)) s++;
+
+        /* sbatch stops at the first command. */
+        if (*s == '\0') continue;
+        if (*s != '#') break;
+        if (strncmp(s, "#SBATCH", 7) != 0) continue;
+
+        for (tok = strtok_r(s + 7, " \t\r", &save); tok;
+             tok = strtok_r(NULL, " \t\r", &save)) {
+            char name[64];
+            char *value;
+
+            if (tok[0] == '#') break;
+
+            if (strncmp(tok, "--", 2) == 0) {
+                /* --name=value or --name value */
+                value = strchr(tok, '=');
+                len = value ? value - tok - 2 : strlen(tok + 2);
+                if (len > sizeof(name) - 1) continue;
+                memcpy(name, tok + 2, len);
+                name[len] = '\0';
+                value = value ? value + 1 : NULL;
+            } else if (tok[0] == '-' && tok[1]) {
+                /* -xvalue or -x value */
+                name[0] = tok[1];
+                name[1] = '\0';
+                value = tok[2] ? tok + 2 : NULL;
+            } else {
+                /* The value of an option this does not look at. */
+                continue;
+            }
+
+            /* Only options with a value take the next token, a flag such as
+             * --exclusive does not. */
+            if (!_takes_value(name)) continue;
+            if (value == NULL) value = strtok_r(NULL, " \t\r", &save);
+            if (value == NULL) break;
+
+            if (!strcmp(name, "partition") || !strcmp(name, "p")) {
+                _set(&job->partition, value);
+            } else if (!strcmp(name, "gres")) {
+                _set(&job->gres, value);
+            } else if (!strcmp(name, "ntasks") || !strcmp(name, "n")) {
+                ntasks = strtoul(value, NULL, 10);
+            } else if (!strcmp(name, "cpus-per-task") || !strcmp(name, "c")) {
+                cpus = strtoul(value, NULL, 10);
+            } else if (!strcmp(name, "nodes") || !strcmp(name, "N")) {
+                nodes = strtoul(value, NULL, 10);
+            } else if (!strcmp(name, "ntasks-per-node")) {
+                per_node = strtoul(value, NULL, 10);
+            }
+        }
+    }
+
+    /* Same estimate slurmctld makes for min_cpus, --ntasks-per-node alone
+     * means one node. */
+    if (per_node && nodes == 0) nodes = 1;
+    n = ntasks;
+    if (nodes * per_node > n) n = nodes * per_node;
+    if (n == 0) n = nodes ? nodes : 1;
+    job->min_cpus = n * (cpus ? cpus : 1);
+
+    return 0;
+}
+
+char *replay_read_file (const char *path, long *size) {
+    char *buf;
+    FILE *fd;
+    long n;
+
+    fd = fopen(path, "rb");
+
+    if (fd == NULL) return NULL;
+
+    if (fseek(fd, 0L, SEEK_END) || (n = ftell(fd)) < 0 ||
+        fseek(fd, 0L, SEEK_SET)) {
+        fclose(fd);
+        return NULL;
+    }
+
+    buf = malloc(n + 1);
+
+    if (buf == NULL || (n && fread(buf, n, 1, fd) != 1)) {
+        free(buf);
+        fclose(fd);
+        return NULL;
+    }
+
+    buf[n] = '\0';
+    fclose(fd);
+
+    if (size) *size = n;
+
+    return buf;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * replay_trace.h: Replayable submission traces built from the job script
+ * archive, shared by job_replay and plugin_bench.
+ *
+ * A trace is a text file with one job per line and tab separated fields:
+ *
+ *   offset_us  jobid  partition  min_cpus  gres  script  workdir  uid
+ *
+ * offset_us is the submission time relative to the first job, missing
+ * strings and unknown uids are written as "-".  Traces written before the uid
+ * field was added are still loaded, with unknown uids.  Lines starting with
+ * '#' are comments.
+ *
+ */
+
+#ifndef _REPLAY_TRACE_H
+#define _REPLAY_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* uid of a job whose user is not known. */
+#define REPLAY_NO_UID ((uint32_t) -1)
+
+/* A single submission. */
+struct replay_job {
+    uint64_t offset_us;     /* Submission time relative to the first job. */
+    uint32_t jobid;
+    uint32_t min_cpus;
+    uint32_t uid;           /* REPLAY_NO_UID if unknown. */
+    char *partition;        /* NULL if not requested. */
+    char *gres;             /* NULL if not requested. */
+    char *script;           /* Path to the archived script. */
+    char *workdir;          /* NULL if unknown. */
+};
+
+/* Load a trace, returns the number of jobs or -1 on error. */
+long replay_load(const char *path, struct replay_job **jobs);
+
+/* Free a loaded trace. */
+void replay_free(struct replay_job *jobs, long njobs);
+
+/* Write one job as a trace line. */
+void replay_write(FILE *fd, const struct replay_job *job);
+
+/* Fill partition, gres and min_cpus from the #SBATCH directives of a job
+ * script, returns 0 on success. */
+int replay_parse_script(const char *script, struct replay_job *job);
+
+/* Read a whole file into a NUL terminated buffer, NULL on error. */
+char *replay_read_file(const char *path, long *size);
+
+#endif /* _REPLAY_TRACE_H */
@@ -0,0 +1,631 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * script_harvester.c: Collect job scripts and environments from slurmctld's
+ * $StateSaveLocation into the job script archive.
+ *
+ * slurmctld keeps the script and environment of every pending or running job
+ * in $StateSaveLocation/hash.<N>/job.<jobid>/{script,environment}.  This
+ * daemon watches the hash.* directories with inotify and copies new jobs in
+ * batches into the same daily layout as job_submit_collect_script:
+ *
+ *   archive/%Y-%m-%d/job<jobid>.script
+ *   archive/%Y-%m-%d/job<jobid>.environment
+ *
+ * so neither job submission nor job launch pays for the collection.  The day
+ * is taken from the job directory, files are written to a temporary name and
+ * renamed with the modification time of the original, which job_replay takes
+ * as the submission time, and jobs already in the archive are skipped.  The
+ * environment is copied in slurmctld's own format, NUL separated with a binary
+ * header.
+ *
+ * A script is only copied once slurmctld is done writing it: when its size
+ * and modification time are the same as in the previous batch, or it has not
+ * changed for HARVEST_SETTLE seconds.  A copy that raced with a change is
+ * thrown away and done again.
+ *
+ * After every batch the time up to which all jobs have been harvested is
+ * saved in a checkpoint file.  Jobs that could not be copied stay queued, and
+ * hold the checkpoint back, until they are or slurmctld purges them.  On
+ * start, and when the inotify queue overflows, the hash directories are
+ * scanned for jobs since the checkpoint.  Jobs that finish and are purged by
+ * slurmctld before the next batch are lost, keep the batch interval well below
+ * MinJobAge.
+ *
+ * It has to run on the slurmctld host as SlurmUser or root.
+ *
+ * gcc -o script_harvester script_harvester.c
+ *
+ * Usage: script_harvester -s state_save_location -d archive_dir
+ *            [-c checkpoint_file] [-b batch_seconds] [-1] [-v]
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+const char *myname = "script_harvester";
+
+/* Seconds of job directories before the checkpoint that are scanned again on
+ * catch up, in case their creation raced with the checkpoint. */
+#define HARVEST_SLACK 60
+
+/* Batches a job is retried in while its script is not there yet. */
+#define HARVEST_TRIES 5
+
+/* Seconds after which an unchanged script is taken as complete without
+ * waiting for another batch. */
+#define HARVEST_SETTLE 2
+
+/* Watched hash directories, slurmctld uses 10 of them. */
+#define HARVEST_NWATCHES 64
+
+/* A job directory waiting for the next batch. */
+struct pending {
+    char path[PATH_MAX];    /* $StateSaveLocation/hash.N/job.ID */
+    uint32_t jobid;
+    time_t seen;            /* When it was queued. */
+    int tries;
+    int failed;             /* Copy failed, reported once. */
+    off_t size;             /* Script size and mtime at the previous batch. */
+    struct timespec mtime;
+};
+
+const char *state_dir = NULL;
+const char *archive_dir = NULL;
+char checkpoint[PATH_MAX];
+int verbose = 0;
+
+struct watch {
+    int wd;
+    char path[PATH_MAX];
+} watches[HARVEST_NWATCHES];
+int nwatches = 0;
+
+struct pending *queue = NULL;
+long nqueue = 0, maxqueue = 0;
+
+/* Jobs copied and failed since start. */
+long nharvested = 0, nfailed = 0;
+
+
+/* Print usage. */
+void _usage (void) {
+    fprintf(stderr,
+        "Usage: %s -s state_save_location -d archive_dir [-c checkpoint_file]\n"
+        "          [-b batch_seconds] [-1] [-v]\n"
+        "\n"
+        "  -c  default: archive_dir/.%s.checkpoint\n"
+        "  -b  seconds between two batches (default 1)\n"
+        "  -1  catch up from the checkpoint once and exit\n",
+        myname, myname);
+}
+
+/* Match "job.<id>", return the job id or -1. */
+long _jobid (const char *name) {
+    char *end;
+    long id;
+
+    if (strncmp(name, "job.", 4) != 0) return -1;
+
+    id = strtol(name + 4, &end, 10);
+
+    return (*end == '\0' && end != name + 4) ? id : -1;
+}
+
+/* Queue a job directory for the next batch. */
+int _queue (const char *dir, const char *name) {
+    long id = _jobid(name);
+    struct pending *p;
+
+    if (id < 0) return 0;
+
+    if (nqueue == maxqueue) {
+        struct pending *tmp;
+
+        maxqueue = maxqueue ? maxqueue * 2 : 1024;
+        tmp = realloc(queue, maxqueue * sizeof(*queue));
+
+        if (tmp == NULL) {
+            fprintf(stderr, "%s: Unable to allocate memory\n", myname);
+            return -1;
+        }
+
+        queue = tmp;
+    }
+
+    p = &queue[nqueue];
+    snprintf(p->path, PATH_MAX, "%s/%s", dir, name);
+    p->jobid = id;
+    p->seen = time(NULL);
+    p->tries = 0;
+    p->failed = 0;
+    p->size = -1;
+    nqueue++;
+
+    return 0;
+}
+
+/* Watch a hash directory for new job directories. */
+void _watch (int ifd, const char *path) {
+    int wd, i;
+
+    if (ifd < 0) return;
+
+    wd = inotify_add_watch(ifd, path, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+
+    if (wd < 0) {
+        fprintf(stderr, "%s: Unable to watch %s: %m\n", myname, path);
+        return;
+    }
+
+    /* Adding an existing watch again returns the same wd. */
+    for (i = 0; i < nwatches; i++) {
+        if (watches[i].wd == wd) return;
+    }
+
+    if (nwatches == HARVEST_NWATCHES) {
+        fprintf(stderr, "%s: Too many hash directories, %s not watched\n",
+            myname, path);
+        inotify_rm_watch(ifd, wd);
+        return;
+    }
+
+    watches[nwatches].wd = wd;
+    snprintf(watches[nwatches].path, PATH_MAX, "%s", path);
+    nwatches++;
+}
+
+/* Directory of a watch, NULL if unknown. */
+const char *_watch_path (int wd) {
+    int i;
+
+    for (i = 0; i < nwatches; i++) {
+        if (watches[i].wd == wd) return watches[i].path;
+    }
+
+    return NULL;
+}
+
+/* Queue the job directories of a hash directory changed since a time. */
+void _scan_hash (const char *dir, time_t since) {
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+
+    if (d == NULL) {
+        fprintf(stderr, "%s: Unable to open %s: %m\n", myname, dir);
+        return;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+        struct stat st;
+
+        if (_jobid(de->d_name) < 0) continue;
+
+        snprintf(path, PATH_MAX, "%s/%s", dir, de->d_name);
+
+        if (stat(path, &st) || st.st_mtime < since) continue;
+
+        /* Keep the checkpoint behind jobs found by a scan until done. */
+        if (_queue(dir, de->d_name) == 0) queue[nqueue - 1].seen = st.st_mtime;
+    }
+
+    closedir(d);
+}
+
+/* Watch the hash directories and queue the jobs changed since a time. */
+int _scan (int ifd, time_t since) {
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(state_dir);
+
+    if (d == NULL) {
+        fprintf(stderr, "%s: Unable to open %s: %m\n", myname, state_dir);
+        return -1;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+
+        if (strncmp(de->d_name, "hash.", 5) != 0) continue;
+
+        snprintf(path, PATH_MAX, "%s/%s", state_dir, de->d_name);
+
+        _watch(ifd, path);
+        _scan_hash(path, since);
+    }
+
+    closedir(d);
+
+    return 0;
+}
+
+/* Copy a file to a temporary name next to the target and rename it, with
+ * the access and modification times of the source.  Fails with EAGAIN if the
+ * source changed during the copy. */
+int _copy (const char *src, const char *dst) {
+    char tmp[PATH_MAX + 8];
+    char buf[65536];
+    struct stat st, st2;
+    struct timespec times[2];
+    ssize_t n;
+    int in, out;
+
+    in = open(src, O_RDONLY | O_CLOEXEC);
+
+    if (in < 0) return -1;
+
+    if (fstat(in, &st)) {
+        close(in);
+        return -1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+    out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (write(out, buf, n) != n) {
+            n = -1;
+            break;
+        }
+    }
+
+    if (n == 0 && (fstat(in, &st2) || st2.st_size != st.st_size ||
+        st2.st_mtim.tv_sec != st.st_mtim.tv_sec ||
+        st2.st_mtim.tv_nsec != st.st_mtim.tv_nsec)) {
+        errno = EAGAIN;
+        n = -1;
+    }
+
+    close(in);
+
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+
+    if (n == 0 && futimens(out, times)) n = -1;
+    if (close(out)) n = -1;
+
+    if (n < 0 || rename(tmp, dst)) {
+        n = errno;
+        unlink(tmp);
+        errno = n;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Copy the script and environment of a job, returns 0 when done, 1 to retry
+ * in the next batch as the script is not there yet, 2 to wait for the script
+ * to settle and -1 on error. */
+int _harvest_job (struct pending *p) {
+    char src[PATH_MAX + 16], dst[PATH_MAX], dir[PATH_MAX];
+    char ds[11];    /* Date string in "%F" ("%Y-%m-%d") format. */
+    struct stat st, sst;
+    struct tm lt;
+    int settled;
+
+    /* Purged already, nothing to do. */
+    if (stat(p->path, &st)) return errno == ENOENT ? 0 : -1;
+
+    snprintf(src, sizeof(src), "%s/script", p->path);
+
+    /* slurmctld has not written the script yet. */
+    if (stat(src, &sst)) return errno == ENOENT ? 1 : -1;
+
+    /* slurmctld may still be writing it. */
+    settled = sst.st_size == p->size &&
+        sst.st_mtim.tv_sec == p->mtime.tv_sec &&
+        sst.st_mtim.tv_nsec == p->mtime.tv_nsec;
+    p->size = sst.st_size;
+    p->mtime = sst.st_mtim;
+
+    if (!settled && time(NULL) - sst.st_mtime < HARVEST_SETTLE) return 2;
+
+    if (localtime_r(&st.st_mtime, &lt) == NULL ||
+        strftime(ds, sizeof(ds), "%F", &lt) == 0) {
+        return -1;
+    }
+
+    snprintf(dir, PATH_MAX, "%s/%s", archive_dir, ds);
+
+    if (mkdir(dir, 0750) && errno != EEXIST) {
+        if (!p->failed) {
+            fprintf(stderr, "%s: Unable to mkdir(%s): %m\n", myname, dir);
+        }
+        return -1;
+    }
+
+    snprintf(dst, PATH_MAX, "%s/job%u.script", dir, p->jobid);
+
+    /* Already in the archive, e.g. by job_submit_collect_script. */
+    if (stat(dst, &st) == 0 && st.st_size == sst.st_size) return 0;
+
+    /* The script goes last, it marks the job as done. */
+    snprintf(src, sizeof(src), "%s/environment", p->path);
+    snprintf(dst, PATH_MAX, "%s/job%u.environment", dir, p->jobid);
+
+    if (access(dst, F_OK) && _copy(src, dst) && errno != ENOENT) {
+        if (errno == EAGAIN) return 2;
+
+        if (!p->failed) {
+            fprintf(stderr, "%s: Unable to copy %s to %s: %m\n", myname, src,
+                dst);
+        }
+        return -1;
+    }
+
+    snprintf(src, sizeof(src), "%s/script", p->path);
+    snprintf(dst, PATH_MAX, "%s/job%u.script", dir, p->jobid);
+
+    if (_copy(src, dst)) {
+        if (errno == EAGAIN) return 2;
+
+        if (!p->failed) {
+            fprintf(stderr, "%s: Unable to copy %s to %s: %m\n", myname, src,
+                dst);
+        }
+        return -1;
+    }
+
+    if (verbose) {
+        fprintf(stderr, "%s: Job %u saved in %s\n", myname, p->jobid, dir);
+    }
+
+    nharvested++;
+
+    return 0;
+}
+
+/* Read the checkpoint, 0 if there is none. */
+time_t _read_checkpoint (void) {
+    long long t = 0;
+    FILE *fd;
+
+    fd = fopen(checkpoint, "r");
+
+    if (fd == NULL) return 0;
+
+    if (fscanf(fd, "%lld", &t) != 1) t = 0;
+
+    fclose(fd);
+
+    return t;
+}
+
+/* Save the checkpoint through a temporary file. */
+int _write_checkpoint (time_t t) {
+    char tmp[PATH_MAX + 8];
+    FILE *fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint);
+    fd = fopen(tmp, "w");
+
+    if (fd == NULL) return -1;
+
+    fprintf(fd, "%lld\n", (long long) t);
+
+    if (fclose(fd) || rename(tmp, checkpoint)) {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Harvest the queued jobs, keep the ones to retry and move the checkpoint up
+ * to the oldest of them. */
+void _batch (void) {
+    time_t done = time(NULL);
+    long i, n = 0;
+
+    for (i = 0; i < nqueue; i++) {
+        struct pending *p = &queue[i];
+        int rv = _harvest_job(p);
+
+        if (rv == 0) continue;
+
+        if (rv == 1 && ++p->tries >= HARVEST_TRIES) {
+            fprintf(stderr, "%s: No script in %s, skipped\n", myname, p->path);
+            nfailed++;
+            continue;
+        }
+
+        /* Failed jobs are retried until slurmctld purges them. */
+        if (rv < 0 && !p->failed) {
+            fprintf(stderr, "%s: Unable to harvest %s, retrying\n", myname,
+                p->path);
+            p->failed = 1;
+        }
+
+        if (p->seen < done) done = p->seen;
+        queue[n++] = *p;
+    }
+
+    nqueue = n;
+
+    if (_write_checkpoint(done)) {
+        fprintf(stderr, "%s: Unable to write %s: %m\n", myname, checkpoint);
+    }
+}
+
+/* Queue the jobs announced by inotify, returns 1 on queue overflow. */
+int _read_events (int ifd, int root_wd) {
+    char buf[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int overflow = 0;
+    ssize_t len;
+    char *p;
+
+    len = read(ifd, buf, sizeof(buf));
+
+    if (len <= 0) return 0;
+
+    for (p = buf; p < buf + len;
+         p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        char path[PATH_MAX];
+        const char *dir;
+
+        if (ev->mask & IN_Q_OVERFLOW) {
+            overflow = 1;
+            continue;
+        }
+
+        if (ev->len == 0 || !(ev->mask & IN_ISDIR)) continue;
+
+        /* A new hash directory, watch it and take what is already in. */
+        if (ev->wd == root_wd) {
+            if (strncmp(ev->name, "hash.", 5) != 0) continue;
+
+            snprintf(path, PATH_MAX, "%s/%s", state_dir, ev->name);
+
+            _watch(ifd, path);
+            _scan_hash(path, 0);
+            continue;
+        }
+
+        dir = _watch_path(ev->wd);
+        if (dir) _queue(dir, ev->name);
+    }
+
+    return overflow;
+}
+
+int main (int argc, char **argv) {
+    struct pollfd pfd;
+    time_t since, last;
+    int batch = 1, once = 0;
+    int ifd = -1, root_wd = -1;
+    int opt;
+
+    checkpoint[0] = '\0';
+
+    while ((opt = getopt(argc, argv, "s:d:c:b:1vh")) != -1) {
+        switch (opt) {
+        case 's':
+            state_dir = optarg;
+            break;
+        case 'd':
+            archive_dir = optarg;
+            break;
+        case 'c':
+            snprintf(checkpoint, PATH_MAX, "%s", optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case '1':
+            once = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            _usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (state_dir == NULL || archive_dir == NULL || batch < 1) {
+        _usage();
+        return 1;
+    }
+
+    if (checkpoint[0] == '\0') {
+        snprintf(checkpoint, PATH_MAX, "%s/.%s.checkpoint", archive_dir,
+            myname);
+    }
+
+    /* Watch before the catch up scan, so no job falls in between. */
+    if (!once) {
+        ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+
+        if (ifd < 0) {
+            fprintf(stderr, "%s: Unable to initialize inotify: %m\n", myname);
+            return 1;
+        }
+
+        root_wd = inotify_add_watch(ifd, state_dir, IN_CREATE | IN_ONLYDIR);
+
+        if (root_wd < 0) {
+            fprintf(stderr, "%s: Unable to watch %s: %m\n", myname, state_dir);
+            return 1;
+        }
+    }
+
+    since = _read_checkpoint();
+    if (since > HARVEST_SLACK) since -= HARVEST_SLACK;
+
+    if (_scan(ifd, since)) return 1;
+
+    fprintf(stderr, "%s: %ld jobs to catch up since %lld\n", myname, nqueue,
+        (long long) since);
+
+    _batch();
+
+    if (once) {
+        int i;
+
+        /* Give recent scripts a chance to settle. */
+        for (i = 1; nqueue && i < HARVEST_TRIES; i++) {
+            sleep(batch);
+            _batch();
+        }
+
+        fprintf(stderr, "%s: %ld jobs harvested, %ld failed\n", myname,
+            nharvested, nfailed + nqueue);
+        return nfailed + nqueue ? 1 : 0;
+    }
+
+    pfd.fd = ifd;
+    pfd.events = POLLIN;
+    last = time(NULL);
+
+    for (;;) {
+        time_t now;
+
+        if (poll(&pfd, 1, batch * 1000) > 0) {
+            /* Lost events, fall back to a scan from the checkpoint. */
+            if (_read_events(ifd, root_wd)) {
+                fprintf(stderr, "%s: inotify queue overflow, rescanning\n",
+                    myname);
+                nqueue = 0;
+                since = _read_checkpoint();
+                _scan(ifd, since > HARVEST_SLACK ? since - HARVEST_SLACK : 0);
+            }
+        }
+
+        /* Copy in batches rather than on every event. */
+        now = time(NULL);
+
+        if (now - last >= batch) {
+            if (nqueue) _batch();
+            last = now;
+        }
+    }
+
+    return 0;
+}
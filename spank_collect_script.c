@@ -8,7 +8,8 @@
  * instrument a slurmctld prolog and collect the job script from the hash dirs
  * within $StateSaveLocation.
  *
- * gcc -shared -fPIC -o spank_collect_script.so spank_collect_script.c
+ * gcc -shared -fPIC -pthread -o spank_collect_script.so spank_collect_script.c
+ *     metrics.c trace.c
  *
  * plugstack.conf:
  * required /etc/slurm/spank/spank_collect_script.so source=/var/slurm/spool
@@ -30,6 +31,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "metrics.h"
+#include "trace.h"
+
 
 SPANK_PLUGIN (spank_collect_script, 1);
 const char *myname = "spank_collect_script";
@@ -129,6 +133,9 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
     /* Size of the buffer. */
     long fsize = 0;
 
+    /* Start time of the script write. */
+    double t0;
+
     /* If not in a remote context no need to proceed. */
     if (spank_remote(sp) != 1) return 0;
 
@@ -191,6 +198,8 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
         return -1;
     }
 
+    trace_init(TRACE_P_SPANK_COLLECT_SCRIPT);
+
     /* Construct current job script location. */
     rv = snprintf(source_file, PATH_MAX, "%s/job%05d/slurm_script", source_base, jobid);
 
@@ -205,17 +214,21 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
         return 0;
     }
 
+    trace_begin(TRACE_E_SCRIPT_READ, jobid);
+
     /* Open the source job script. */
     fd = fopen(source_file, "rb");
 
     if (fd == NULL) {
         slurm_error("%s: Unable to open %s: %m", myname, source_file);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
     /* Get the size of the source job script. */
     if (fseek(fd, 0L, SEEK_END)) {
         slurm_error("%s: Unable to fseek to end of %s: %m", myname, source_file);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
@@ -224,16 +237,19 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
     /* If source job script is empty no need to proceed. */
     if (fsize == 0) {
         slurm_info("%s: %s is empty", myname, source_file);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return 0;
     }
 
     if (fsize == -1) {
         slurm_error("%s: error getting size of %s: %m", myname, source_file);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
     if (fseek(fd, 0L, SEEK_SET)) {
         slurm_error("%s: Unable to fseek to start of %s: %m", myname, source_file);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
@@ -242,6 +258,7 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
 
     if (buffer == NULL) {
         slurm_error("%s: Unable to allocate buffer: %m", myname);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
@@ -252,12 +269,15 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
     if (ferror(fd)) {
         slurm_error("%s: Error on reading %s: %m", myname, source_file);
         free(buffer);
+        trace_end(TRACE_E_SCRIPT_READ, jobid, 0);
         return -1;
     }
 
     /* Close the source file. */
     fclose(fd);
 
+    trace_end(TRACE_E_SCRIPT_READ, jobid, fsize);
+
     /* Obtain current date string. */
     if (_get_datestr(ds, sizeof(ds))) {
         slurm_error("%s: Unable to get current date string", myname);
@@ -310,12 +330,16 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
         return -1;
     }
 
+    trace_begin(TRACE_E_SCRIPT_WRITE, jobid);
+    t0 = metrics_now();
+
     /* Open the target file for write. */
     fd = fopen(target_file, "wb");
 
     if (fd == NULL) {
         slurm_error("%s: Unable to open %s: %m", myname, target_file);
         _clean_exit(ruid, rgid, buffer);
+        trace_end(TRACE_E_SCRIPT_WRITE, jobid, 0);
         return -1;
     }
 
@@ -325,16 +349,33 @@ int slurm_spank_init (spank_t sp, int ac, char **av) {
     if (ferror(fd)) {
         slurm_error("%s: Error on writing %s: %m", myname, target_file);
         _clean_exit(ruid, rgid, buffer);
+        trace_end(TRACE_E_SCRIPT_WRITE, jobid, 0);
         return -1;
     }
 
     /* Close the target file. */
     fclose(fd);
 
+    trace_end(TRACE_E_SCRIPT_WRITE, jobid, fsize);
+
     slurm_info("%s: Job script saved as %s", myname, target_file);
 
     /* Clean exit. */
     _clean_exit(ruid, rgid, buffer);
 
+    /* Map the metrics state file with the original credentials. */
+    if (metrics_init(METRICS_SLURMSTEPD) == 0) {
+        metrics_observe(M_SCRIPT_WRITE_SECONDS, metrics_now() - t0);
+        metrics_add(M_SCRIPTS_COLLECTED, NULL, 1);
+        metrics_add(M_SCRIPT_BYTES, NULL, fsize);
+    }
+
+    return 0;
+}
+
+/* Write the metrics this step updated. */
+int slurm_spank_exit (spank_t sp, int ac, char **av) {
+    metrics_fini();
+
     return 0;
 }
@@ -5,7 +5,7 @@
  *                function is called.
  *
  *
- * gcc -shared -fPIC -o spank_demo.so spank_demo.c
+ * gcc -shared -fPIC -o spank_demo.so spank_demo.c trace.c
  *
  * plugstack.conf:
  * required /etc/slurm/spank/spank_demo.so
@@ -15,6 +15,8 @@
 #include <unistd.h>
 #include <slurm/spank.h>
 
+#include "trace.h"
+
 
 SPANK_PLUGIN (spank_demo, 1);
 const char *myname = "spank_demo";
@@ -23,11 +25,18 @@ const char *myname = "spank_demo";
 int _display_msg(spank_t sp, char const *caller, char const *msg) {
     uid_t uid = getuid();
     gid_t gid = getgid();
+    uint32_t jobid = 0;
     char hostname[1024];
 
     int ctx = spank_context();
     char *ctx_str[] = {"ERROR", "LOCAL", "REMOTE", "ALLOCATOR", "SLURMD", "JOB_SCRIPT"};
 
+    /* Job ID is not available in all contexts. */
+    spank_get_item(sp, S_JOB_ID, &jobid);
+
+    trace_init(TRACE_P_SPANK_DEMO);
+    trace_event(TRACE_E_CALLBACK, TRACE_INSTANT, jobid, ctx);
+
     hostname[1023] = '\0';
     gethostname(hostname, 1023);
 
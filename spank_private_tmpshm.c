@@ -23,27 +23,71 @@
  *    will bypass the namespace created by this plugin and falls back to the
  *    default namespace, such as Hadoop and Spark jobs. (TODO)
  *
+ * With "tmpfs=size" the job's /tmp is a private tmpfs of at most "size" bytes
+ * (k, m, g suffixes accepted) instead of the disk based tmpdir.  Small, short
+ * lived files get memory speed while the size cap protects the node from OOM.
+ * Large outputs should be written to /var/tmp, which is still bound to the
+ * disk tmpdir.  The tmpfs is mounted by the prolog on a mount point in the
+ * root only "ram_base" directory, never in a world writable one, and unmounted
+ * by the epilog if the mount point is there.
  *
- * gcc -shared -fPIC -o spank_private_tmpshm.so rmrf.c spank_private_tmpshm.c
+ * gcc -shared -fPIC -pthread -o spank_private_tmpshm.so spank_private_tmpshm.c
+ *     idcache.c metrics.c trace.c
+ *
+ * With "ipc" each job step also gets its own IPC namespace, created in
+ * slurmstepd before the tasks are forked so that all tasks of the step share
+ * it, with a private mqueue file system on /dev/mqueue.  SysV shared memory,
+ * semaphores and message queues, and POSIX message queues, left behind by the
+ * step are freed by the kernel when its last task exits.
+ *
+ * Jobs can ask for scratch space with "--scratch=size".  The prolog then
+ * checks that /tmp and /dev/shm, where the job may put it, both have that much
+ * free space (statvfs) on top of what the other jobs on the node have reserved
+ * in a node local ledger, and records the job's reservation.  Otherwise the
+ * prolog fails, the reason goes to the slurmd log, and slurmd drains the node
+ * ("Prolog error") and requeues the job as for any prolog failure.  The
+ * reservation is given back by the epilog, or by the prolog itself if it
+ * fails later on.  Reservations are counted in full even when jobs have
+ * already written part of their data, so the check errs on the safe side.  In
+ * case an epilog never ran, every prolog drops the reservations, older than
+ * LEDGER_GRACE seconds, of jobs without a slurmstepd socket left in the
+ * SlurmdSpoolDir given by "spool=".  The ledger lives in /run, so a reboot
+ * clears it.
+ *
+ * The job's --tmp is not used for this: SPANK has no item for it in the
+ * prolog, and Slurm only matches it against the TmpDisk configured for each
+ * node, it reserves nothing.
  *
  * plugstack.conf:
- * required /etc/slurm/spank/spank_private_tmpshm.so
+ * required /etc/slurm/spank/spank_private_tmpshm.so [tmpfs=size] [ipc]
+ *     [spool=dir]
  *
  */
 
 #define _GNU_SOURCE
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ftw.h>
 #include <linux/limits.h>
-#include <pwd.h>
 #include <sched.h>
 #include <slurm/spank.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/mount.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "idcache.h"
+#include "metrics.h"
+#include "trace.h"
+
 
 SPANK_PLUGIN (spank_private_tmpshm, 1);
 const char *myname = "spank_private_tmpshm";
@@ -53,11 +97,48 @@ extern int rmrf(const char*);
 const char *shm_base = "/dev/shm";
 const char *tmp_base = "/tmp";
 const char *var_base = "/var/tmp";
+const char *mqueue_base = "/dev/mqueue";
+
+/* Size in bytes of the tmpfs bound to /tmp, 0 to bind the disk tmpdir
+ * instead. */
+uint64_t tmpfs_size = 0;
+
+/* Directory of the tmpfs mount points, only root may have access to it since
+ * the mounts are made as root - need to modify. */
+const char *ram_base = "/run/spank_private_tmpshm";
+
+/* Private IPC namespace per job step. */
+int private_ipc = 0;
+
+/* Scratch space reservations of the jobs on the node, "jobid bytes time"
+ * lines. */
+const char *ledger_path = "/run/spank_private_tmpshm.ledger";
+
+/* SlurmdSpoolDir, holding a socket per job step, "spool=" overrides it. */
+const char *spool_dir = "/var/spool/slurmd";
+
+/* Seconds a reservation is kept before its job has a step on the node. */
+#define LEDGER_GRACE 300
+
+int _scratch_opt_cb (int val, const char *optarg, int remote);
+
+struct spank_option spank_options[] = {
+    { "scratch", "size", "Scratch space needed in /tmp on each node, k, m, g "
+      "or t suffix.", 1, 0, _scratch_opt_cb },
+    SPANK_OPTIONS_TABLE_END
+};
+
+/* Number of files removed by _rmrf(). */
+uint64_t nremoved = 0;
 
 
 /* Unlink callback function to handle both file and directory. */
 int _unlink_cb_f(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-    return remove(fpath);
+    int rv = remove(fpath);
+
+    if (rv == 0 && typeflag != FTW_DP) nremoved++;
+
+    return rv;
 }
 
 /* rm -rf */
@@ -65,82 +146,514 @@ int _rmrf(const char *path) {
     return nftw(path, _unlink_cb_f, 64, FTW_DEPTH | FTW_PHYS);
 }
 
-/* Build per-job tmpdir and shmdir directory names. */
-int _get_tmpshm (spank_t sp, char *tmpdir, char *shmdir) {
-    uint32_t jobid;
+/* Convert a size with an optional k, m, g or t suffix to bytes. */
+int _str2size (const char *str, uint64_t *size) {
+    unsigned long long n;
+    int shift = 0;
+    char *p;
+
+    if (*str < '0' || *str > '9') return -1;
+
+    errno = 0;
+    n = strtoull(str, &p, 10);
+
+    if (errno) return -1;
+
+    switch (*p) {
+    case 'k': case 'K': shift = 10; p++; break;
+    case 'm': case 'M': shift = 20; p++; break;
+    case 'g': case 'G': shift = 30; p++; break;
+    case 't': case 'T': shift = 40; p++; break;
+    }
+
+    if (*p != '\0' || n > (UINT64_MAX >> shift)) return -1;
+
+    *size = (uint64_t) n << shift;
+
+    return 0;
+}
+
+/* Processing plugstack arguments. */
+void _get_args (int ac, char **av) {
+    int i;
+
+    for (i = 0; i < ac; i++) {
+        if (strncmp("tmpfs=", av[i], 6) == 0) {
+            if (_str2size(av[i] + 6, &tmpfs_size)) {
+                slurm_error("%s: Invalid tmpfs size: %s, ignored", myname, av[i] + 6);
+                tmpfs_size = 0;
+            }
+        } else if (strcmp("ipc", av[i]) == 0) {
+            private_ipc = 1;
+        } else if (strncmp("spool=", av[i], 6) == 0) {
+            spool_dir = av[i] + 6;
+        }
+    }
+}
+
+/* Build the tmpfs tier (ramdir) mount point name. */
+int _get_ramdir (uint32_t jobid, char *ramdir) {
     int rv;
 
-    if (spank_get_item(sp, S_JOB_ID, &jobid)) {
-        slurm_error("%s: Unable to get JOBID", myname);
+    rv = snprintf(ramdir, PATH_MAX, "%s/job%u", ram_base, jobid);
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        slurm_error("%s: Unable to construct ramdir: %s/job%u", myname, ram_base, jobid);
         return -1;
     }
 
-    rv = snprintf(tmpdir, PATH_MAX, "%s/job%d", tmp_base, jobid);
+    return 0;
+}
+
+/* Make sure a directory is ours and nobody else can write to it, lstat() so
+ * that a symlink is refused rather than followed. */
+int _own_dir (const char *path) {
+    struct stat st;
 
-    if (rv < 0 || rv > PATH_MAX - 1) {
-        slurm_error("%s: Unable to construct tmpdir: %s/job%d", myname, tmp_base, jobid);
+    if (lstat(path, &st)) return -1;
+
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+        (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        slurm_error("%s: %s is not a directory of uid %u only, refused",
+            myname, path, geteuid());
+        errno = EPERM;
         return -1;
     }
 
-    rv = snprintf(shmdir, PATH_MAX, "%s/job%d", shm_base, jobid);
+    return 0;
+}
 
-    if (rv < 0 || rv > PATH_MAX - 1) {
-        slurm_error("%s: Unable to construct shmdir: %s/job%d", myname, shm_base, jobid);
+/* Mount a tmpfs of tmpfs_size bytes owned by the job user on ramdir.  It is
+ * not layered over tmpdir, which stays writable as /var/tmp.  The mount point
+ * is created in ram_base, where no user can plant a symlink, and is the
+ * record the epilog unmounts from. */
+int _mount_ramdir (uint32_t jobid, uid_t uid, gid_t gid) {
+    char ramdir[PATH_MAX];
+    char opts[PATH_MAX];
+    int err;
+
+    if (_get_ramdir(jobid, ramdir)) return -1;
+
+    if (mkdir(ram_base, 0700) && errno != EEXIST) {
+        err = errno;
+        slurm_error("%s: Unable to mkdir(%s, 0700): %m", myname, ram_base);
+        errno = err;
+        return -1;
+    }
+
+    if (_own_dir(ram_base)) return -1;
+
+    if (mkdir(ramdir, 0700) && errno != EEXIST) {
+        err = errno;
+        slurm_error("%s: Unable to mkdir(%s, 0700): %m", myname, ramdir);
+        errno = err;
+        return -1;
+    }
+
+    if (_own_dir(ramdir)) return -1;
+
+    snprintf(opts, sizeof(opts), "size=%llu,mode=0700,uid=%u,gid=%u",
+        (unsigned long long) tmpfs_size, uid, gid);
+
+    if (mount("tmpfs", ramdir, "tmpfs", MS_NOSUID|MS_NODEV, opts)) {
+        err = errno;
+        slurm_error("%s: Unable to mount tmpfs(%s) on %s: %m", myname, opts, ramdir);
+        errno = err;
         return -1;
     }
 
     return 0;
 }
 
-/* Create tmpdir and shmdir in prolog. */
-int slurm_spank_job_prolog (spank_t sp, int ac, char **av) {
-    uid_t uid = -1;
-    gid_t gid = -1;
-    struct passwd *pwd = NULL;
+/* Lazily unmount the tmpfs, which frees its memory, and remove its mount
+ * point.  Nothing to do if the prolog did not create one. */
+int _umount_ramdir (uint32_t jobid) {
+    char ramdir[PATH_MAX];
+    struct stat st;
+    int err;
 
-    char tmpdir[PATH_MAX];
-    char shmdir[PATH_MAX];
+    if (_get_ramdir(jobid, ramdir)) return -1;
 
-    /* In prolog we can get uid but not gid. */
-    if (spank_get_item(sp, S_JOB_UID, &uid)) {
-        slurm_error("%s: Unable to get uid: %m", myname);
+    if (lstat(ram_base, &st) && errno == ENOENT) return 0;
+    if (_own_dir(ram_base)) return -1;
+    if (lstat(ramdir, &st) && errno == ENOENT) return 0;
+
+    if (umount2(ramdir, MNT_DETACH|UMOUNT_NOFOLLOW) && errno != EINVAL) {
+        err = errno;
+        slurm_error("%s: Unable to umount(%s): %m", myname, ramdir);
+        errno = err;
         return -1;
     }
 
-    /* Get gid of the user. */
-    errno = 0;
-    pwd = getpwuid(uid);
-    if (errno) {
-        slurm_error("%s, Unable to get gid: %m", myname);
+    if (rmdir(ramdir) && errno != ENOENT) {
+        err = errno;
+        slurm_error("%s: Unable to rmdir(%s): %m", myname, ramdir);
+        errno = err;
+        return -1;
     }
 
-    gid = pwd->pw_gid;
+    return 0;
+}
 
-    /* Get private tmp and shm locations. */
-    if (_get_tmpshm(sp, tmpdir, shmdir)) {
-        slurm_error("%s: Unable to construct tmpdir or shmdir", myname);
+/* Validate --scratch on the submission side already. */
+int _scratch_opt_cb (int val, const char *optarg, int remote) {
+    uint64_t size;
+
+    if (optarg == NULL || _str2size(optarg, &size)) {
+        slurm_error("%s: Invalid --scratch size: %s", myname,
+            optarg ? optarg : "");
         return -1;
     }
 
+    return 0;
+}
+
+/* Collect the ids of the jobs with a step on the node, from the slurmstepd
+ * sockets "<node>_<jobid>.<stepid>" in SlurmdSpoolDir.  Returns the number
+ * of ids, or -1 if unknown. */
+long _live_jobs (uint32_t **ids) {
+    struct dirent *de;
+    long n = 0, max = 0;
+    DIR *d;
+
+    *ids = NULL;
+    d = opendir(spool_dir);
+
+    if (d == NULL) return -1;
+
+    while ((de = readdir(d)) != NULL) {
+        char *p = strrchr(de->d_name, '_'), *end;
+        unsigned long id;
+
+        if (p == NULL || p[1] < '0' || p[1] > '9') continue;
+
+        id = strtoul(p + 1, &end, 10);
+
+        if (*end != '.') continue;
+
+        if (n == max) {
+            uint32_t *tmp;
+
+            max = max ? max * 2 : 64;
+            tmp = realloc(*ids, max * sizeof(uint32_t));
+
+            if (tmp == NULL) {
+                free(*ids);
+                *ids = NULL;
+                closedir(d);
+                return -1;
+            }
+
+            *ids = tmp;
+        }
+
+        (*ids)[n++] = id;
+    }
+
+    closedir(d);
+
+    return n;
+}
+
+/* Whether a ledger entry is left over from a job whose epilog never ran. */
+int _stale (unsigned long long id, long long since, uint32_t *live, long nlive,
+        time_t now) {
+    long i;
+
+    if (nlive < 0 || now - since < LEDGER_GRACE) return 0;
+
+    for (i = 0; i < nlive; i++) {
+        if (live[i] == id) return 0;
+    }
+
+    return 1;
+}
+
+/* Reserve size bytes for a job in the ledger, or release its reservation if
+ * size is 0.  A reservation fails if it would take the reserved total over
+ * avail, stale reservations are dropped on the way.  Returns 0 on success, 1
+ * if it does not fit and -1 on error, the space reserved by the other jobs
+ * goes in reserved. */
+int _ledger (uint32_t jobid, uint64_t size, uint64_t avail, uint64_t *reserved) {
+    unsigned long long id, bytes;
+    long long since;
+    uint64_t others = 0;
+    uint32_t *live = NULL;
+    long nlive = -1;
+    time_t now = time(NULL);
+    char *buf = NULL, *line = NULL;
+    size_t len = 0, linelen = 0;
+    FILE *in, *out;
+    int fd, rv = 0;
+
+    fd = open(ledger_path, O_RDWR | O_CLOEXEC | (size ? O_CREAT : 0), 0600);
+
+    if (fd < 0) return (size == 0 && errno == ENOENT) ? 0 : -1;
+
+    /* The lock goes away with the file descriptor. */
+    if (flock(fd, LOCK_EX) || (in = fdopen(fd, "r+")) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    /* Sum the other reservations, keep them in memory for the rewrite. */
+    out = open_memstream(&buf, &len);
+
+    if (out == NULL) {
+        fclose(in);
+        return -1;
+    }
+
+    /* Only worth it when reserving, the prolog of a new job. */
+    if (size) nlive = _live_jobs(&live);
+
+    while (getline(&line, &linelen, in) != -1) {
+        since = 0;
+
+        if (sscanf(line, "%llu %llu %lld", &id, &bytes, &since) < 2) continue;
+        if (id == jobid || _stale(id, since, live, nlive, now)) continue;
+
+        others += bytes;
+        fprintf(out, "%llu %llu %lld\n", id, bytes, since);
+    }
+
+    free(line);
+    free(live);
+
+    if (reserved) *reserved = others;
+
+    if (size && (others > avail || size > avail - others)) {
+        rv = 1;
+    } else {
+        if (size) {
+            fprintf(out, "%u %llu %lld\n", jobid, (unsigned long long) size,
+                (long long) now);
+        }
+        fflush(out);
+
+        rewind(in);
+
+        if (fwrite(buf, 1, len, in) != len || fflush(in) ||
+            ftruncate(fileno(in), len)) {
+            rv = -1;
+        }
+    }
+
+    fclose(out);
+    free(buf);
+    fclose(in);
+
+    return rv;
+}
+
+/* Admission check of the scratch space requested by the job, returns -1 if
+ * it does not fit on the node. */
+int _check_scratch (spank_t sp, uint32_t jobid) {
+    const char *bases[2] = {tmp_base, shm_base};
+    const char *base = NULL;
+    uint64_t size, avail = UINT64_MAX, reserved = 0;
+    struct statvfs vfs;
+    char *optarg = NULL;
+    char reason[512];
+    int i, rv;
+
+    if (spank_option_getopt(sp, &spank_options[0], &optarg) != ESPANK_SUCCESS
+        || optarg == NULL) {
+        return 0;
+    }
+
+    if (_str2size(optarg, &size)) {
+        slurm_error("%s: Invalid --scratch size: %s", myname, optarg);
+        return -1;
+    }
+
+    /* The job may write to either, the fullest one decides. */
+    for (i = 0; i < 2; i++) {
+        if (statvfs(bases[i], &vfs)) {
+            slurm_error("%s: Unable to statvfs(%s): %m", myname, bases[i]);
+            return -1;
+        }
+
+        if ((uint64_t) vfs.f_bavail * vfs.f_frsize < avail) {
+            avail = (uint64_t) vfs.f_bavail * vfs.f_frsize;
+            base = bases[i];
+        }
+    }
+
+    rv = _ledger(jobid, size, avail, &reserved);
+
+    /* A broken ledger should not fail every job on the node. */
+    if (rv < 0) {
+        slurm_error("%s: Unable to update %s, scratch check skipped: %m",
+            myname, ledger_path);
+        return 0;
+    }
+
+    if (rv == 0) return 0;
+
+    snprintf(reason, sizeof(reason), "%s: job %u needs %llu MB of %s, %llu MB "
+        "free, %llu MB reserved", myname, jobid,
+        (unsigned long long) size >> 20, base,
+        (unsigned long long) avail >> 20, (unsigned long long) reserved >> 20);
+    slurm_error("%s", reason);
+
+    return -1;
+}
+
+/* Build per-job tmpdir and shmdir directory names. */
+int _get_tmpshm (spank_t sp, uint32_t *jobid, char *tmpdir, char *shmdir) {
+    int rv;
+
+    if (spank_get_item(sp, S_JOB_ID, jobid)) {
+        slurm_error("%s: Unable to get JOBID", myname);
+        return -1;
+    }
+
+    rv = snprintf(tmpdir, PATH_MAX, "%s/job%d", tmp_base, *jobid);
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        slurm_error("%s: Unable to construct tmpdir: %s/job%d", myname, tmp_base, *jobid);
+        return -1;
+    }
+
+    rv = snprintf(shmdir, PATH_MAX, "%s/job%d", shm_base, *jobid);
+
+    if (rv < 0 || rv > PATH_MAX - 1) {
+        slurm_error("%s: Unable to construct shmdir: %s/job%d", myname, shm_base, *jobid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Create tmpdir, shmdir and the tmpfs of a job owned by the job user. */
+int _setup_tmpshm (uint32_t jobid, uid_t uid, const char *tmpdir,
+        const char *shmdir) {
+    gid_t gid = -1;
+    int err;
+
+    trace_begin(TRACE_E_ID_LOOKUP, jobid);
+
+    /* Get gid of the user, from the node's cache unless it is stale. */
+    if (idcache_getuid(uid, &gid, NULL, 0)) {
+        err = errno;
+        slurm_error("%s: Unable to get gid of uid %u: %m", myname, uid);
+        trace_end(TRACE_E_ID_LOOKUP, jobid, err);
+        return -1;
+    }
+
+    trace_end(TRACE_E_ID_LOOKUP, jobid, 0);
+    trace_begin(TRACE_E_MKDIR, jobid);
+
     /* Create private tmp and shm directories. */
     if (mkdir(tmpdir, 0700) && errno != EEXIST) {
+        err = errno;
         slurm_error("%s: Unable to mkdir(%s, 0700): %m", myname, tmpdir);
+        trace_end(TRACE_E_MKDIR, jobid, err);
         return -1;
     }
 
     if (mkdir(shmdir, 0700) && errno != EEXIST) {
+        err = errno;
         slurm_error("%s: Unable to mkdir(%s, 0700): %m", myname, shmdir);
+        trace_end(TRACE_E_MKDIR, jobid, err);
         return -1;
     }
 
     /* Change the ownership to current job user. */
     if (chown(tmpdir, uid, gid)) {
+        err = errno;
         slurm_error("%s: Unable to chown(%s, %u, %u): %m", myname, tmpdir, uid, gid);
+        trace_end(TRACE_E_MKDIR, jobid, err);
         return -1;
     }
 
     if (chown(shmdir, uid, gid)) {
+        err = errno;
         slurm_error("%s: Unable to chown(%s, %u, %u): %m", myname, shmdir, uid, gid);
+        trace_end(TRACE_E_MKDIR, jobid, err);
+        return -1;
+    }
+
+    /* Mount the tmpfs that becomes the job's /tmp. */
+    if (tmpfs_size && _mount_ramdir(jobid, uid, gid)) {
+        err = errno;
+        trace_end(TRACE_E_MKDIR, jobid, err);
+        _umount_ramdir(jobid);
+        return -1;
+    }
+
+    trace_end(TRACE_E_MKDIR, jobid, 0);
+
+    return 0;
+}
+
+/* Create the IPC namespace of the step in slurmstepd, whose main thread
+ * later forks the tasks, so they all inherit it. */
+int slurm_spank_init (spank_t sp, int ac, char **av) {
+    uint32_t jobid = 0;
+    int err;
+
+    /* If not in a remote context no need to proceed. */
+    if (spank_remote(sp) != 1) return 0;
+
+    _get_args(ac, av);
+
+    if (!private_ipc) return 0;
+
+    spank_get_item(sp, S_JOB_ID, &jobid);
+
+    trace_init(TRACE_P_SPANK_PRIVATE_TMPSHM);
+    trace_begin(TRACE_E_UNSHARE, jobid);
+
+    if (unshare(CLONE_NEWIPC)) {
+        err = errno;
+        slurm_error("%s: Unable to unshare(CLONE_NEWIPC): %m", myname);
+        trace_end(TRACE_E_UNSHARE, jobid, err);
+        return -1;
+    }
+
+    trace_end(TRACE_E_UNSHARE, jobid, 0);
+
+    return 0;
+}
+
+/* Create tmpdir and shmdir in prolog. */
+int slurm_spank_job_prolog (spank_t sp, int ac, char **av) {
+    uid_t uid = -1;
+
+    uint32_t jobid;
+    char tmpdir[PATH_MAX];
+    char shmdir[PATH_MAX];
+
+    /* In prolog we can get uid but not gid. */
+    if (spank_get_item(sp, S_JOB_UID, &uid)) {
+        slurm_error("%s: Unable to get uid: %m", myname);
+        return -1;
+    }
+
+    _get_args(ac, av);
+
+    /* Get private tmp and shm locations. */
+    if (_get_tmpshm(sp, &jobid, tmpdir, shmdir)) {
+        slurm_error("%s: Unable to construct tmpdir or shmdir", myname);
+        return -1;
+    }
+
+    trace_init(TRACE_P_SPANK_PRIVATE_TMPSHM);
+    trace_begin(TRACE_E_SCRATCH_CHECK, jobid);
+
+    /* Fail fast if the job's scratch space does not fit. */
+    if (_check_scratch(sp, jobid)) {
+        trace_end(TRACE_E_SCRATCH_CHECK, jobid, 1);
+        return -1;
+    }
+
+    trace_end(TRACE_E_SCRATCH_CHECK, jobid, 0);
+
+    /* Give the reservation back if the job does not start here. */
+    if (_setup_tmpshm(jobid, uid, tmpdir, shmdir)) {
+        _ledger(jobid, 0, 0, NULL);
         return -1;
     }
 
@@ -151,75 +664,152 @@ int slurm_spank_job_prolog (spank_t sp, int ac, char **av) {
  * namespace for each task before the priviledge is dropped. This callback
  * function is only executed in a remote context. */
 int slurm_spank_task_init_privileged (spank_t sp, int ac, char **av) {
+    uint32_t jobid;
     char tmpdir[PATH_MAX];
     char shmdir[PATH_MAX];
+    char ramdir[PATH_MAX];
+    int err;
+
+    _get_args(ac, av);
 
     /* Get private tmp and shm locations. */
-    if (_get_tmpshm(sp, tmpdir, shmdir)) {
+    if (_get_tmpshm(sp, &jobid, tmpdir, shmdir)) {
         slurm_error("%s: Unable to construct tmpdir or shmdir", myname);
         return -1;
     }
 
+    if (tmpfs_size && _get_ramdir(jobid, ramdir)) return -1;
+
+    trace_init(TRACE_P_SPANK_PRIVATE_TMPSHM);
+    trace_begin(TRACE_E_UNSHARE, jobid);
+
     /* Make entire '/' mount tree shareable. */
     if (mount("", "/", "none", MS_REC|MS_SHARED, "")) {
+        err = errno;
         slurm_error("%s: Unable to share '/' mounts: %m", myname);
+        trace_end(TRACE_E_UNSHARE, jobid, err);
         return -1;
     }
 
     /* Create a new namespace. */
     if (unshare(CLONE_NEWNS)) {
+        err = errno;
         slurm_error("%s: Unable to unshare(CLONE_NEWNS): %m", myname);
+        trace_end(TRACE_E_UNSHARE, jobid, err);
         return -1;
     }
 
     /* Make entire '/' mount tree slave. */
     if (mount("", "/", "none", MS_REC|MS_SLAVE, "")) {
+        err = errno;
         slurm_error("%s: Unable to 'mount --make-rslave /'", myname);
+        trace_end(TRACE_E_UNSHARE, jobid, err);
         return -1;
     }
 
+    trace_end(TRACE_E_UNSHARE, jobid, 0);
+    trace_begin(TRACE_E_BIND_MOUNT, jobid);
+
     /* Bind mount '/var/tmp'. */
     if (mount(tmpdir, var_base, "none", MS_BIND, "")) {
+        err = errno;
         slurm_error("%s: Unable to bind mount(%s, %s): %m", myname, tmpdir, var_base);
+        trace_end(TRACE_E_BIND_MOUNT, jobid, err);
         return -1;
     }
 
-    /* Bind mount '/tmp'. */
-    if (mount(tmpdir, tmp_base, "none", MS_BIND, "")) {
-        slurm_error("%s: Unable to bind mount(%s, %s): %m", myname, tmpdir, tmp_base);
+    /* Bind mount '/tmp', the tmpfs if there is one. */
+    if (mount(tmpfs_size ? ramdir : tmpdir, tmp_base, "none", MS_BIND, "")) {
+        err = errno;
+        slurm_error("%s: Unable to bind mount(%s, %s): %m", myname,
+            tmpfs_size ? ramdir : tmpdir, tmp_base);
+        trace_end(TRACE_E_BIND_MOUNT, jobid, err);
         return -1;
     }
 
     /* Bind mount '/dev/shm'. */
     if (mount(shmdir, shm_base, "none", MS_BIND, "")) {
+        err = errno;
         slurm_error("%s: Unable to bind mount(%s, %s): %m", myname, shmdir, shm_base);
+        trace_end(TRACE_E_BIND_MOUNT, jobid, err);
         return -1;
     }
 
+    /* Mount the mqueue file system of the step's IPC namespace. */
+    if (private_ipc && mount("mqueue", mqueue_base, "mqueue",
+        MS_NOSUID|MS_NODEV|MS_NOEXEC, "") && errno != ENOENT) {
+        err = errno;
+        slurm_error("%s: Unable to mount mqueue on %s: %m", myname, mqueue_base);
+        trace_end(TRACE_E_BIND_MOUNT, jobid, err);
+        return -1;
+    }
+
+    trace_end(TRACE_E_BIND_MOUNT, jobid, 0);
+
     return 0;
 }
 
 /* Remove tmpdir and shmdir in epilog. */
 int slurm_spank_job_epilog (spank_t sp, int ac, char **av) {
+    uint32_t jobid;
     char tmpdir[PATH_MAX];
     char shmdir[PATH_MAX];
+    double t0;
+    int err = 0, rv = 0;
+
+    _get_args(ac, av);
 
     /* Get private tmp and shm locations. */
-    if (_get_tmpshm(sp, tmpdir, shmdir)) {
+    if (_get_tmpshm(sp, &jobid, tmpdir, shmdir)) {
         slurm_error("%s: Unable to construct tmpdir or shmdir", myname);
         return -1;
     }
 
+    /* Release the scratch space reservation. */
+    if (_ledger(jobid, 0, 0, NULL) < 0) {
+        slurm_error("%s: Unable to update %s: %m", myname, ledger_path);
+    }
+
+    trace_init(TRACE_P_SPANK_PRIVATE_TMPSHM);
+    trace_begin(TRACE_E_RMRF, jobid);
+    metrics_init(METRICS_SLURMSTEPD);
+    t0 = metrics_now();
+    nremoved = 0;
+
+    /* Free the tmpfs tier even if "tmpfs=" has since been removed from
+     * plugstack.conf, the prolog may have mounted one.  tmp and shm are
+     * removed whatever happens to it. */
+    if (_umount_ramdir(jobid)) {
+        err = errno;
+        rv = -1;
+    }
+
     /* Remove tmp and shm. */
     if (_rmrf(tmpdir) && errno != ENOENT) {
+        err = errno;
         slurm_error("%s: Unable to rmrf(%s) (tmpdir): %m", myname, tmpdir);
-        return -1;
+        rv = -1;
     }
 
     if (_rmrf(shmdir) && errno != ENOENT) {
+        err = errno;
         slurm_error("%s: Unable to rmrf(%s) (shmdir): %m", myname, shmdir);
-        return -1;
+        rv = -1;
+    }
+
+    trace_end(TRACE_E_RMRF, jobid, rv ? err : 0);
+
+    if (rv == 0) {
+        metrics_observe(M_TMP_CLEANUP_SECONDS, metrics_now() - t0);
+        metrics_observe(M_TMP_FILES_REMOVED, nremoved);
     }
 
+    return rv;
+}
+
+/* Write the metrics the epilog updated. */
+int slurm_spank_exit (spank_t sp, int ac, char **av) {
+    metrics_fini();
+
     return 0;
 }
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * trace.c: Lightweight event tracing shared by all plugins, see trace.h.
+ *
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+
+const char *trace_plugin_names[TRACE_P_MAX] = {
+    "none",
+    "job_submit_collect_script",
+    "job_submit_require_cpu_gpu_ratio",
+    "spank_demo",
+    "spank_collect_script",
+    "spank_private_tmpshm",
+    "job_submit_rate_limit",
+    "job_submit_app_fingerprint",
+};
+
+const char *trace_event_names[TRACE_E_MAX] = {
+    "none",
+    "check_ratio",
+    "callback",
+    "script_read",
+    "script_write",
+    "workdir_write",
+    "mkdir",
+    "unshare",
+    "bind_mount",
+    "rmrf",
+    "fingerprint",
+    "rate_limit",
+    "scratch_check",
+    "id_lookup",
+};
+
+/* Initialization state: 0 = not tried, 1 = in progress, 2 = ready,
+ * -1 = disabled. */
+static int trace_state = 0;
+static struct trace_header *trace_hdr = NULL;
+static struct trace_rec *trace_slots = NULL;
+static uint8_t trace_plugin = TRACE_P_NONE;
+static uint32_t trace_pid = 0;
+static __thread uint32_t trace_tid = 0;
+
+
+/* getpid() is a syscall, cache it and refresh it in forked children. */
+static void _trace_atfork_child (void) {
+    trace_pid = getpid();
+    trace_tid = 0;
+}
+
+/* Map the ring buffer and initialize the header if it is new. */
+static int _trace_map (void) {
+    size_t size = sizeof(struct trace_header) +
+        (size_t) TRACE_NSLOTS * sizeof(struct trace_rec);
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(TRACE_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) || ((size_t) st.st_size != size && ftruncate(fd, size))) {
+        close(fd);
+        return -1;
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+
+    trace_hdr = p;
+    trace_slots = (struct trace_rec *) (trace_hdr + 1);
+
+    /* A freshly truncated file is zero filled, the first mapper publishes the
+     * geometry.  Events recorded before that are still valid. */
+    if (__atomic_load_n(&trace_hdr->magic, __ATOMIC_ACQUIRE) == 0) {
+        uint32_t zero = 0;
+
+        trace_hdr->version = TRACE_VERSION;
+        trace_hdr->nslots = TRACE_NSLOTS;
+        trace_hdr->slot_size = sizeof(struct trace_rec);
+        __atomic_compare_exchange_n(&trace_hdr->magic, &zero, TRACE_MAGIC, 0,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+
+    /* Refuse to write into a buffer with a different layout. */
+    if (trace_hdr->magic != TRACE_MAGIC ||
+        trace_hdr->version != TRACE_VERSION ||
+        trace_hdr->nslots != TRACE_NSLOTS ||
+        trace_hdr->slot_size != sizeof(struct trace_rec)) {
+        munmap(p, size);
+        trace_hdr = NULL;
+        trace_slots = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+int trace_init (int plugin) {
+    int state = __atomic_load_n(&trace_state, __ATOMIC_ACQUIRE);
+
+    if (state == 2) return 0;
+    if (state != 0) return -1;
+
+    /* Only one thread attempts the mapping. */
+    if (!__atomic_compare_exchange_n(&trace_state, &state, 1, 0,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return state == 2 ? 0 : -1;
+    }
+
+    trace_plugin = plugin;
+    trace_pid = getpid();
+
+    if (_trace_map() || pthread_atfork(NULL, NULL, _trace_atfork_child)) {
+        __atomic_store_n(&trace_state, -1, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    __atomic_store_n(&trace_state, 2, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void trace_event (int event, char phase, uint32_t jobid, uint32_t arg) {
+    struct trace_rec *r;
+    struct timespec ts;
+    uint64_t idx;
+
+    if (__atomic_load_n(&trace_state, __ATOMIC_ACQUIRE) != 2) return;
+
+    /* So is gettid(), once per thread. */
+    if (trace_tid == 0) trace_tid = syscall(SYS_gettid);
+
+    /* clock_gettime() is served from the vDSO, no syscall. */
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    /* Reserve a slot, the oldest event is overwritten when full. */
+    idx = __atomic_fetch_add(&trace_hdr->head, 1, __ATOMIC_RELAXED);
+    r = &trace_slots[idx & (TRACE_NSLOTS - 1)];
+
+    /* Mark the slot incomplete so a concurrent reader skips it. */
+    __atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    r->ts = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    r->jobid = jobid;
+    r->pid = trace_pid;
+    r->tid = trace_tid;
+    r->event = event;
+    r->plugin = trace_plugin;
+    r->phase = phase;
+    r->arg = arg;
+
+    __atomic_store_n(&r->seq, idx + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * trace.h: Lightweight event tracing shared by all plugins.
+ *
+ * Events are fixed-size binary records written into a per-node ring buffer
+ * that lives in an mmap'd file (TRACE_PATH).  Recording an event takes one
+ * atomic increment and a few stores, no locks and no syscalls, so it can be
+ * left enabled in slurmctld and slurmstepd.  Use trace2json to convert the
+ * buffer into Chrome trace / Perfetto JSON.
+ *
+ * If the buffer cannot be created or mapped (e.g. slurmctld running as
+ * SlurmUser without write access to TRACE_PATH) tracing is silently disabled.
+ * Pre-create the file with the proper ownership to enable it in that case.
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/* Location of the ring buffer, override with -DTRACE_PATH=... */
+#ifndef TRACE_PATH
+#define TRACE_PATH "/run/slurm_plugins.trace"
+#endif
+
+/* Number of event slots, must be a power of 2. */
+#ifndef TRACE_NSLOTS
+#define TRACE_NSLOTS 65536
+#endif
+
+#define TRACE_MAGIC 0x544c5053  /* "SPLT" */
+#define TRACE_VERSION 2
+
+/* Event phases, same as the Chrome trace "ph" field. */
+#define TRACE_BEGIN 'B'
+#define TRACE_END 'E'
+#define TRACE_INSTANT 'i'
+
+/* Plugins emitting events. */
+enum trace_plugin {
+    TRACE_P_NONE = 0,
+    TRACE_P_JOB_SUBMIT_COLLECT_SCRIPT,
+    TRACE_P_JOB_SUBMIT_REQUIRE_CPU_GPU_RATIO,
+    TRACE_P_SPANK_DEMO,
+    TRACE_P_SPANK_COLLECT_SCRIPT,
+    TRACE_P_SPANK_PRIVATE_TMPSHM,
+    TRACE_P_JOB_SUBMIT_RATE_LIMIT,
+    TRACE_P_JOB_SUBMIT_APP_FINGERPRINT,
+    TRACE_P_MAX
+};
+
+/* Traced events. */
+enum trace_event {
+    TRACE_E_NONE = 0,
+    TRACE_E_CHECK_RATIO,
+    TRACE_E_CALLBACK,
+    TRACE_E_SCRIPT_READ,
+    TRACE_E_SCRIPT_WRITE,
+    TRACE_E_WORKDIR_WRITE,
+    TRACE_E_MKDIR,
+    TRACE_E_UNSHARE,
+    TRACE_E_BIND_MOUNT,
+    TRACE_E_RMRF,
+    TRACE_E_FINGERPRINT,
+    TRACE_E_RATE_LIMIT,
+    TRACE_E_SCRATCH_CHECK,
+    TRACE_E_ID_LOOKUP,
+    TRACE_E_MAX
+};
+
+/* Buffer header, padded to a cache line. */
+struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slot_size;
+    uint64_t head;      /* Total number of events ever reserved. */
+    char pad[40];
+};
+
+/* A single event record (40 bytes). */
+struct trace_rec {
+    uint64_t seq;       /* Slot index + 1 once complete, 0 while written. */
+    uint64_t ts;        /* CLOCK_REALTIME in nanoseconds. */
+    uint32_t jobid;
+    uint32_t pid;
+    uint16_t event;
+    uint8_t  plugin;
+    uint8_t  phase;
+    uint32_t arg;       /* Event specific: bytes, return code, ... */
+    uint32_t tid;       /* B/E pairs only nest within a thread. */
+    uint32_t pad;
+};
+
+extern const char *trace_plugin_names[TRACE_P_MAX];
+extern const char *trace_event_names[TRACE_E_MAX];
+
+/* Map the ring buffer for writing, cheap to call repeatedly. */
+int trace_init(int plugin);
+
+/* Record an event, no-op if tracing is disabled. */
+void trace_event(int event, char phase, uint32_t jobid, uint32_t arg);
+
+#define trace_begin(event, jobid) trace_event(event, TRACE_BEGIN, jobid, 0)
+#define trace_end(event, jobid, arg) trace_event(event, TRACE_END, jobid, arg)
+
+#endif /* _TRACE_H */
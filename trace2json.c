@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2016-2017, Yong Qin <yong.qin@lbl.gov>. All rights reserved.
+ *
+ * trace2json.c: Convert the plugin trace ring buffer (see trace.h) to Chrome
+ * trace / Perfetto JSON.
+ *
+ * The buffer can be read while plugins are writing to it, slots that are being
+ * overwritten during the dump are skipped.  Load the output in
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * gcc -o trace2json trace2json.c trace.c
+ *
+ * Usage: trace2json [-f trace_file] [-j jobid] > trace.json
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+
+const char *myname = "trace2json";
+
+
+/* Print usage. */
+void _usage (void) {
+    fprintf(stderr, "Usage: %s [-f trace_file] [-j jobid]\n", myname);
+}
+
+/* Emit one event as a JSON object. */
+void _print_rec (const struct trace_rec *r, int first) {
+    const char *event = r->event < TRACE_E_MAX ?
+        trace_event_names[r->event] : "unknown";
+    const char *plugin = r->plugin < TRACE_P_MAX ?
+        trace_plugin_names[r->plugin] : "unknown";
+
+    printf("%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\","
+        "\"ts\":%" PRIu64 ".%03" PRIu64 ",\"pid\":%u,\"tid\":%u,%s"
+        "\"args\":{\"jobid\":%u,\"arg\":%u}}",
+        first ? "" : ",", event, plugin, r->phase,
+        r->ts / 1000, r->ts % 1000, r->pid, r->tid,
+        r->phase == TRACE_INSTANT ? "\"s\":\"p\"," : "",
+        r->jobid, r->arg);
+}
+
+int main (int argc, char **argv) {
+    const char *path = TRACE_PATH;
+    long jobid = -1;
+    struct trace_header *hdr;
+    struct trace_rec *slots;
+    struct stat st;
+    uint64_t head, idx;
+    int first = 1;
+    int fd, opt;
+    void *p;
+
+    while ((opt = getopt(argc, argv, "f:j:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            path = optarg;
+            break;
+        case 'j':
+            jobid = strtol(optarg, NULL, 10);
+            break;
+        default:
+            _usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "%s: Unable to open %s: %s\n", myname, path,
+            strerror(errno));
+        return 1;
+    }
+
+    if (fstat(fd, &st) || st.st_size < sizeof(struct trace_header)) {
+        fprintf(stderr, "%s: %s is not a trace buffer\n", myname, path);
+        return 1;
+    }
+
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "%s: Unable to mmap %s: %s\n", myname, path,
+            strerror(errno));
+        return 1;
+    }
+
+    hdr = p;
+    slots = (struct trace_rec *) (hdr + 1);
+
+    /* Validate the layout before touching any slot. */
+    if (hdr->magic != TRACE_MAGIC || hdr->version != TRACE_VERSION ||
+        hdr->slot_size != sizeof(struct trace_rec) ||
+        (hdr->nslots & (hdr->nslots - 1)) != 0 ||
+        st.st_size < sizeof(struct trace_header) +
+            (size_t) hdr->nslots * sizeof(struct trace_rec)) {
+        fprintf(stderr, "%s: %s has an unknown layout\n", myname, path);
+        return 1;
+    }
+
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    idx = head > hdr->nslots ? head - hdr->nslots : 0;
+
+    printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (; idx < head; idx++) {
+        struct trace_rec *s = &slots[idx & (hdr->nslots - 1)];
+        struct trace_rec r;
+
+        /* Copy the slot and make sure it was not rewritten meanwhile. */
+        if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != idx + 1) continue;
+        memcpy(&r, s, sizeof(r));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != idx + 1) continue;
+
+        if (jobid >= 0 && r.jobid != jobid) continue;
+
+        _print_rec(&r, first);
+        first = 0;
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}